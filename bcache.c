@@ -0,0 +1,189 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "nd100.h"
+#include "bcache.h"
+
+/*
+ * Mark a range of instructions as not ending a block.
+ */
+void BlockCache_Straight(int start, int stop) {
+	int i;
+	for(i=start;i<=stop;i++)
+		bc_straight[i] = 1;
+	return;
+}
+
+/*
+ * Set up which instructions a block may continue after. Anything that
+ * jumps, changes level, paging, interrupt or ring state, or talks to
+ * the outside world ends a block. Skips and ROPs with P as destination
+ * are caught at run time instead, since they leave P != P+1.
+ */
+void Setup_BlockCache() {
+	int i;
+
+	memset(bc_straight,0,sizeof(bc_straight));
+	BlockCache_Straight(0000000,0123777);		/* Memory reference, except JMP */
+	BlockCache_Straight(0140130,0140132);		/* BFILL, MOVB, MOVBF */
+	BlockCache_Straight(0141200,0141277);		/* RMPY */
+	BlockCache_Straight(0141600,0141677);		/* RDIV */
+	BlockCache_Straight(0142200,0142277);		/* LBYT */
+	BlockCache_Straight(0142600,0142677);		/* SBYT */
+	BlockCache_Straight(0143200,0143306);		/* MIX3, LDATX - STDTX */
+	for(i=0144000;i<=0147777;i++)			/* ROPs, but not those touching STS */
+		bc_straight[i] = ((i & 0070) && (i & 0007)) ? 1 : 0;
+	BlockCache_Straight(0151400,0152377);		/* NLZ, DNZ */
+	BlockCache_Straight(0154000,0157777);		/* Shifts */
+	BlockCache_Straight(0170000,0173777);		/* Argument instructions */
+	for(i=0174000;i<=0177777;i++)			/* Bit operations, but not on STS (can hit PIL) */
+		bc_straight[i] = (i & 0007) ? 1 : 0;
+
+	Setup_HLE();
+	BlockCacheFlush();
+}
+
+/*
+ * Throw away all cached blocks.
+ * Needed if the instruction handlers are changed at runtime.
+ */
+void BlockCacheFlush() {
+	int i;
+	for(i=0;i<BC_SIZE;i++)
+		bc_table[i].len = 0;
+	memset(bc_pagemap,0,sizeof(bc_pagemap));
+	memset(bc_codemap,0,sizeof(bc_codemap));
+	bc_break = 1;
+}
+
+/*
+ * A word in a page with cached code has been written.
+ * If it is part of a cached block, drop all blocks in that page
+ * and stop any block running now.
+ */
+void BlockCacheWrite(ulong paddr) {
+	ulong page = paddr >> 10;
+	if (bc_codemap[paddr >> 5] & (1U << (paddr & 31))) {
+		memset(&bc_codemap[page << 5],0,1024/8);
+		bc_pagemap[page] = 0;
+		bc_pagegen[page]++;
+		bc_break = 1;
+	}
+}
+
+/*
+ * Decode a new block starting at physical address paddr.
+ * A block never crosses a page boundary.
+ */
+static void BlockBuild(struct BlockEntry *b, ulong paddr) {
+	ulong a = paddr;
+	ushort instr;
+	int n = 0;
+
+	b->hle = (HLE_COUNT) ? HleFind(paddr) : NULL;
+	if (b->hle) {	/* the whole routine is the block, so writes to any of it are seen */
+		while (n < b->hle->len) {
+			bc_codemap[a >> 5] |= 1U << (a & 31);
+			n++;
+			a++;
+		}
+	} else {
+		do {
+			instr = VolatileMemory->n_Array[a];
+			b->instr[n] = instr;
+			b->func[n] = INSTR_FUNC(instr);	/* for the current ring, see BlockRun */
+			b->fused[n] = NULL;
+			b->width[n] = 1;
+			bc_codemap[a >> 5] |= 1U << (a & 31);
+			n++;
+			a++;
+		} while ((n < BC_MAXLEN) && ((bc_straight[instr] && (a & 0x3ff)) ||
+			 ((a & 0x3ff) && FuseExtend(instr,VolatileMemory->n_Array[a]))));	/* keep SKP/JMP together */
+	}
+	b->paddr = paddr;
+	b->disp = gReg->myreg_DISP;
+	b->gen = bc_pagegen[paddr >> 10];
+	b->len = n;
+	b->hits = (b->hle) ? JIT_THRESHOLD : 0;	/* nothing for fusion or the JIT to do */
+	b->native = NULL;
+	bc_pagemap[paddr >> 10] = 1;
+}
+
+/*
+ * Run the block starting at physical address paddr, which is where
+ * the instruction at P was prefetched from.
+ * Returns the number of instructions executed, 0 if the block could not
+ * be used and the caller has to interpret the instruction instead.
+ * On return the next instruction has been prefetched, as after do_op.
+ */
+int BlockRun(ulong paddr) {
+	struct BlockEntry *b;
+	ushort p;
+	int i, n, w;
+
+	if (gPC >= 0176000)	/* Top page can be shadow memory, leave it to the interpreter */
+		return(0);
+
+	b = &bc_table[BC_HASH(paddr)];
+	if ((b->paddr != paddr) || (b->gen != bc_pagegen[paddr >> 10]) || !b->len ||
+	    (b->disp != gReg->myreg_DISP))	/* built in another ring */
+		BlockBuild(b,paddr);
+
+	if (!b->native && (b->hits < JIT_THRESHOLD)) {
+		b->hits++;
+		if (FUSION && (b->hits == FUSE_THRESHOLD))
+			BlockFuse(b);
+		if (JIT && (b->hits == JIT_THRESHOLD))
+			JitCompile(b);
+	}
+
+	bc_break = 0;
+	if (b->hle) {
+		n = HleRun(b);
+		if (!n)
+			return(0);
+	} else if (b->native) {
+		n = b->native(gReg->myreg_CUR,!STS_PONI);
+	} else {
+		i = n = 0;
+		while (i < b->len) {
+			p = gPC;
+			if (b->fused[i]) {
+				w = b->width[i];
+				n += b->fused[i](&b->instr[i]);
+			} else {
+				w = 1;
+				b->func[i](b->instr[i]);
+				n++;
+			}
+			i += w;
+			if (bc_break || (gPC != (ushort)(p + w)))
+				break;
+		}
+	}
+	HEAT_N(HM_FETCH,paddr,(n > 0) ? n - 1 : 0);	/* The first was fetched before, the one after is fetched below */
+	prefetch();
+	return(n);
+}
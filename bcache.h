@@ -0,0 +1,63 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Predecoded basic block cache, see struct BlockEntry in nd100.h
+ */
+
+struct BlockEntry bc_table[BC_SIZE];
+
+/* Pages holding cached code, and which words in them that are cached */
+unsigned char bc_pagemap[MEMPTSIZE];
+unsigned int bc_pagegen[MEMPTSIZE];
+unsigned int bc_codemap[MEMPTSIZE*1024/32];
+
+/* Instructions a block may continue after (1 = straight line) */
+unsigned char bc_straight[65536];
+
+/* Set whenever a running block must stop after the current instruction */
+volatile int bc_break;
+
+/* Config switch, block cache on or off */
+int BLOCK_CACHE = 1;
+
+extern struct CpuRegs *gReg;
+extern _NDRAM_ *VolatileMemory;
+
+void BlockCache_Straight(int start, int stop);
+void Setup_BlockCache(void);
+void BlockCacheWrite(ulong paddr);
+void BlockCacheFlush(void);
+int BlockRun(ulong paddr);
+
+extern int JIT;
+extern int FUSION;
+extern void BlockFuse(struct BlockEntry *b);
+extern bool FuseExtend(ushort last, ushort next);
+extern bool JitCompile(struct BlockEntry *b);
+extern int HLE_COUNT;
+extern void Setup_HLE(void);
+extern struct HleRoutine *HleFind(ulong paddr);
+extern int HleRun(struct BlockEntry *b);
+extern unsigned long long *hm_count;
+extern int HEATMAP_LEVELS;
+
+extern void prefetch();
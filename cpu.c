@@ -30,6 +30,7 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <signal.h>
+#include <setjmp.h>
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -44,9 +45,24 @@
 
 struct termios savetty;
 
-/* Interrupt thread synchronization */
+/* Interrupt thread synchronization, now only for the ident chain */
 sem_t sem_int;
 
+/* Things for the cpu loop to look at, EVT_* bits posted with PostEvent */
+volatile int cpu_events;
+
+/* Software TLB for each level, see MemoryRead */
+struct TLB cpu_tlb[16];
+static ushort tlb_msb;	/* PONI and SEXI the TLBs were filled with */
+
+/* The page prefetch is running in, see prefetch. NULL when not known */
+static ushort *pf_page;
+static ushort pf_vpn;
+
+/* Where an instruction aborted by a memory fault goes, see MemoryAbort */
+static sigjmp_buf cpu_abort;
+static bool cpu_abort_on = false;	/* set while one of the cpu loops runs */
+
 /* mopc synchronization */
 sem_t sem_mopc;
 
@@ -666,69 +682,93 @@ void OpToStr(char *opstr, ushort operand) {
 	}
 }
 
+/*
+ * Effective address for each of the 8 addressing modes, the same
+ * calculation New_GetEffectiveAddr does, one mode per macro so the
+ * memory reference handlers below can be specialized per mode.
+ * apt is set to whether the alternative page table is to be used.
+ */
+#define EA_DISP(instr)	((char)((instr) & 0xFF))
+#define EA_0(instr,apt)	((apt) = false, (ushort)(gPC + EA_DISP(instr)))					/* (P) + disp */
+#define EA_1(instr,apt)	((apt) = true, (ushort)(gB + EA_DISP(instr)))					/* (B) + disp */
+#define EA_2(instr,apt)	((apt) = true, MemoryRead((ushort)(gPC + EA_DISP(instr)),false))		/* ((P) + disp) */
+#define EA_3(instr,apt)	((apt) = true, MemoryRead((ushort)(gB + EA_DISP(instr)),true))		/* ((B) + disp) */
+#define EA_4(instr,apt)	((apt) = true, (ushort)(gX + EA_DISP(instr)))					/* (X) + disp */
+#define EA_5(instr,apt)	((apt) = true, (ushort)(gB + gX + EA_DISP(instr)))				/* (B) + disp + (X) */
+#define EA_6(instr,apt)	((apt) = true, (ushort)(gX + MemoryRead((ushort)(gPC + EA_DISP(instr)),false)))	/* ((P) + disp) + (X) */
+#define EA_7(instr,apt)	((apt) = true, (ushort)(gX + MemoryRead((ushort)(gB + EA_DISP(instr)),true)))	/* ((B) + disp) + (X) */
+
+/*
+ * Generates name_0 .. name_7 from name_ea, one handler per addressing mode,
+ * and the table name_mode[] of them for Setup_Instructions to install.
+ */
+#define MEMREF_MODE(name,m)						\
+	static void name##_##m(ushort operand) {			\
+		bool UseAPT;						\
+		ushort eff_addr = EA_##m(operand,UseAPT);		\
+		name##_ea(operand,eff_addr,UseAPT);			\
+	}
+#define MEMREF_HANDLERS(name)						\
+	MEMREF_MODE(name,0) MEMREF_MODE(name,1)				\
+	MEMREF_MODE(name,2) MEMREF_MODE(name,3)				\
+	MEMREF_MODE(name,4) MEMREF_MODE(name,5)				\
+	MEMREF_MODE(name,6) MEMREF_MODE(name,7)				\
+	void (*name##_mode[8])(ushort) = {				\
+		name##_0, name##_1, name##_2, name##_3,			\
+		name##_4, name##_5, name##_6, name##_7			\
+	};
+
 /* STZ
  */
-void ndfunc_stz(ushort operand){
-	bool UseAPT;
-	ushort eff_addr;
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
+static inline void ndfunc_stz_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	MemoryWrite(0,eff_addr,UseAPT,2);
 	gPC++;
 }
+MEMREF_HANDLERS(ndfunc_stz)
 
 /* STA
  */
-void ndfunc_sta(ushort operand){
-	bool UseAPT;
-	ushort eff_addr;
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
-	trace_step(1,"(%06o)<=A",(int)eff_addr);
+static inline void ndfunc_sta_ea(ushort operand, ushort eff_addr, bool UseAPT){
+	if (trace) trace_step(1,"(%06o)<=A",(int)eff_addr);
 	MemoryWrite(gA,eff_addr,UseAPT,2);
 	gPC++;
 }
+MEMREF_HANDLERS(ndfunc_sta)
 
 /* STT
  */
-void ndfunc_stt(ushort operand){
-	bool UseAPT;
-	ushort eff_addr;
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
+static inline void ndfunc_stt_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	MemoryWrite(gT,eff_addr,UseAPT,2);
 	gPC++;
 }
+MEMREF_HANDLERS(ndfunc_stt)
 
 /* STX
  */
-void ndfunc_stx(ushort operand){
-	bool UseAPT;
-	ushort eff_addr;
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
+static inline void ndfunc_stx_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	MemoryWrite(gX,eff_addr,UseAPT,2);
 	gPC++;
 }
+MEMREF_HANDLERS(ndfunc_stx)
 
 /* STD
  */
-void ndfunc_std(ushort operand){
-	bool UseAPT;
-	ushort eff_addr;
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
+static inline void ndfunc_std_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	MemoryWrite(gA,eff_addr + 0,UseAPT,2);
 	MemoryWrite(gD,eff_addr + 1,UseAPT,2);
 	gPC++;
 }
+MEMREF_HANDLERS(ndfunc_std)
 
 /* STF
  */
-void ndfunc_stf(ushort operand){
-	bool UseAPT;
-	ushort eff_addr;
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
+static inline void ndfunc_stf_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	MemoryWrite(gT,eff_addr + 0,UseAPT,2);
 	MemoryWrite(gA,eff_addr + 1,UseAPT,2);
 	MemoryWrite(gD,eff_addr + 2,UseAPT,2);
 	gPC++;
 }
+MEMREF_HANDLERS(ndfunc_stf)
 
 /* STZTX
  */
@@ -738,7 +778,6 @@ void ndfunc_stztx(ushort operand){
 	temp = (operand & 0x0038)>>3;
 	fulladdress = (((unsigned int)gT) <<16) | (ushort)(gX + temp);
 	PhysMemWrite(0,fulladdress);
-	/* TODO:: privilege check... */
 	gPC++;
 }
 
@@ -750,7 +789,6 @@ void ndfunc_statx(ushort operand){
 	temp = (operand & 0x0038)>>3;
 	fulladdress = (((unsigned int)gT) <<16) | (ushort)(gX + temp);
 	PhysMemWrite(gA,fulladdress);
-	/* TODO:: privilege check... */
 	gPC++;
 }
 
@@ -764,60 +802,50 @@ void ndfunc_stdtx(ushort operand){
 	PhysMemWrite(gA,fulladdress);
 	fulladdress++;
 	PhysMemWrite(gD,fulladdress);
-	/* TODO:: privilege check... */
 	gPC++;
 }
 
 /* LDA
  */
-void ndfunc_lda(ushort operand){
+static inline void ndfunc_lda_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	if (trace) trace_pre(1,"A",(int)gA);
-	bool UseAPT;
-	ushort eff_addr;
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
 	gA = MemoryRead(eff_addr,UseAPT);
 	if (DISASM)
 		disasm_set_isdata(eff_addr);
-	trace_step(1,"A<=(%06o)",(int)eff_addr);
+	if (trace) trace_step(1,"A<=(%06o)",(int)eff_addr);
 	gPC++;
 	if (trace) trace_post(1,"A",(int)gA);
 }
+MEMREF_HANDLERS(ndfunc_lda)
 
 /* LDT
  */
-void ndfunc_ldt(ushort operand){
+static inline void ndfunc_ldt_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	if (trace) trace_pre(1,"T",(int)gT);
-	bool UseAPT;
-	ushort eff_addr;
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
 	gT = MemoryRead(eff_addr,UseAPT);
 	if (DISASM)
 		disasm_set_isdata(eff_addr);
 	gPC++;
 	if (trace) trace_post(1,"T",(int)gT);
 }
+MEMREF_HANDLERS(ndfunc_ldt)
 
 /* LDX
  */
-void ndfunc_ldx(ushort operand){
+static inline void ndfunc_ldx_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	if (trace) trace_pre(1,"X",(int)gX);
-	bool UseAPT;
-	ushort eff_addr;
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
 	gX = MemoryRead(eff_addr,UseAPT);
 	if (DISASM)
 		disasm_set_isdata(eff_addr);
 	gPC++;
 	if (trace) trace_post(1,"X",(int)gX);
 }
+MEMREF_HANDLERS(ndfunc_ldx)
 
 /* LDD
  */
-void ndfunc_ldd(ushort operand){
+static inline void ndfunc_ldd_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	if (trace) trace_pre(2,"A",(int)gA,"D",(int)gD);
-	bool UseAPT;
-	ushort eff_addr;
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
 	gA = MemoryRead(eff_addr + 0,UseAPT);
 	gD = MemoryRead(eff_addr + 1,UseAPT);
 	if (DISASM){
@@ -827,20 +855,19 @@ void ndfunc_ldd(ushort operand){
 	if (trace) trace_post(2,"A",(int)gA,"D",(int)gD);
 	gPC++;
 }
+MEMREF_HANDLERS(ndfunc_ldd)
 
 /* LDF
  */
-void ndfunc_ldf(ushort operand){
+static inline void ndfunc_ldf_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	if (trace) trace_pre(3,"T",(int)gT,"A",(int)gA,"D",(int)gD);
-	bool UseAPT;
-	ushort eff_addr;
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
 	gT = MemoryRead(eff_addr + 0,UseAPT);
 	gA = MemoryRead(eff_addr + 1,UseAPT);
 	gD = MemoryRead(eff_addr + 2,UseAPT);
 	if (trace) trace_post(3,"T",(int)gT,"A",(int)gA,"D",(int)gD);
 	gPC++;
 }
+MEMREF_HANDLERS(ndfunc_ldf)
 
 /* LDATX
  */
@@ -850,7 +877,6 @@ void ndfunc_ldatx(ushort operand){
 	temp = (operand & 0x0038)>>3;
 	fulladdress = (((unsigned int)gT) <<16) | (ushort)(gX + temp);
 	gA = PhysMemRead(fulladdress);
-	/* TODO:: privilege check... */
 	gPC++;
 }
 
@@ -862,7 +888,6 @@ void ndfunc_ldxtx(ushort operand){
 	temp = (operand & 0x0038)>>3;
 	fulladdress = (((unsigned int)gT) <<16) | (ushort)(gX + temp);
 	gX = PhysMemRead(fulladdress);
-	/* TODO:: privilege check... */
 	gPC++;
 }
 
@@ -876,7 +901,6 @@ void ndfunc_lddtx(ushort operand){
 	gA = PhysMemRead(fulladdress);
 	fulladdress++;
 	gD = PhysMemRead(fulladdress);
-	/* TODO:: privilege check... */
 	gPC++;
 }
 
@@ -895,17 +919,13 @@ void ndfunc_ldbtx(ushort operand){
 	result = temp + temp;
 	temp = PhysMemRead(result);
 	gB = 0177000 | temp;
-	/* TODO:: privilege check... */
 	gPC++;
 }
 
 /* MIN
  */
-void ndfunc_min(ushort operand){
-	bool UseAPT;
+static inline void ndfunc_min_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	ushort temp;
-	ushort eff_addr;
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
 	temp = MemoryRead(eff_addr,UseAPT);
 	temp++;
 	MemoryWrite(temp,eff_addr + 0,UseAPT,2);
@@ -913,60 +933,50 @@ void ndfunc_min(ushort operand){
 		gPC ++;	/* Next instruction is skipped */
 	gPC++;
 }
+MEMREF_HANDLERS(ndfunc_min)
 
 /* ADD
  */
-void ndfunc_add(ushort operand){
-	bool UseAPT;
+static inline void ndfunc_add_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	ushort eff_word;
-	ushort eff_addr;
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
 	eff_word = MemoryRead(eff_addr,UseAPT);
 	gA = do_add(gA,eff_word,0);
 	gPC++;
 }
+MEMREF_HANDLERS(ndfunc_add)
 
 /* SUB
  */
-void ndfunc_sub(ushort operand){
-	bool UseAPT;
+static inline void ndfunc_sub_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	ushort eff_word;
-	ushort eff_addr;
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
 	eff_word = MemoryRead(eff_addr,UseAPT);
 	gA = do_add(gA,~eff_word,1);
 	gPC++;
 }
+MEMREF_HANDLERS(ndfunc_sub)
 
 /* AND
  */
-void ndfunc_and(ushort operand){
-	bool UseAPT;
-	ushort eff_addr;
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
+static inline void ndfunc_and_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	gA = gA & MemoryRead(eff_addr,UseAPT);
 	gPC++;
 }
+MEMREF_HANDLERS(ndfunc_and)
 
 /* ORA
  */
-void ndfunc_ora(ushort operand){
-	bool UseAPT;
-	ushort eff_addr;
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
+static inline void ndfunc_ora_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	gA = gA | MemoryRead(eff_addr,UseAPT);
 	gPC++;
 }
+MEMREF_HANDLERS(ndfunc_ora)
 
 /* FAD
  */
-void ndfunc_fad(ushort operand){
-	bool UseAPT;
-	ushort eff_addr;
+static inline void ndfunc_fad_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	ushort a[3], b[3], r[3];
 	int res;
 
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
 	a[0] = gT;
 	a[1] = gA;
 	a[2] = gD;
@@ -984,15 +994,13 @@ void ndfunc_fad(ushort operand){
 	if (trace) trace_post(3,"T",(int)gT,"A",(int)gA,"D",(int)gD);
 	gPC++;
 }
+MEMREF_HANDLERS(ndfunc_fad)
 
 /* FSB
  */
-void ndfunc_fsb(ushort operand){
-	bool UseAPT;
-	ushort eff_addr;
+static inline void ndfunc_fsb_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	ushort a[3], b[3], r[3];
 
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
 	b[0] = gT;
 	a[0] = gT;
 	a[1] = gA;
@@ -1009,15 +1017,13 @@ void ndfunc_fsb(ushort operand){
 	if (trace) trace_post(3,"T",(int)gT,"A",(int)gA,"D",(int)gD);
 	gPC++;
 }
+MEMREF_HANDLERS(ndfunc_fsb)
 
 /* FMU
  */
-void ndfunc_fmu(ushort operand){
-	bool UseAPT;
-	ushort eff_addr;
+static inline void ndfunc_fmu_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	ushort a[3], b[3], r[3];
 
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
 	a[0] = gT;
 	a[1] = gA;
 	a[2] = gD;
@@ -1033,15 +1039,13 @@ void ndfunc_fmu(ushort operand){
 	if (trace) trace_post(3,"T",(int)gT,"A",(int)gA,"D",(int)gD);
 	gPC++;
 }
+MEMREF_HANDLERS(ndfunc_fmu)
 
 /* FDV
  */
-void ndfunc_fdv(ushort operand){
-	bool UseAPT;
-	ushort eff_addr;
+static inline void ndfunc_fdv_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	ushort a[3], b[3], r[3];
 
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
 	a[0] = gT;
 	a[1] = gA;
 	a[2] = gD;
@@ -1057,20 +1061,19 @@ void ndfunc_fdv(ushort operand){
 	if (trace) trace_post(3,"T",(int)gT,"A",(int)gA,"D",(int)gD);
 	gPC++;
 }
+MEMREF_HANDLERS(ndfunc_fdv)
 
 /* JMP
  */
-void ndfunc_jmp(ushort operand){
-	bool UseAPT;
-	ushort eff_addr;
+static inline void ndfunc_jmp_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	ushort old_gPC=gPC;
 
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
 	gPC = eff_addr;
 	if (DISASM)
 		disasm_userel(old_gPC,gPC);
 
 }
+MEMREF_HANDLERS(ndfunc_jmp)
 
 /* GECO
  */
@@ -1203,6 +1206,8 @@ void ndfunc_irw(ushort operand){
 
 	temp = ((operand & 0x0078) >> 3);
 	dr = (operand & 0x0007);
+	if (!dr)
+		SyncSTS();
 	if (( temp == gPIL ) && (dr == 2)) /* P on current level, this becomes NOOP */
 		;
 	else
@@ -1216,6 +1221,8 @@ void ndfunc_irw(ushort operand){
 /* IRR
  */
 void ndfunc_irr(ushort operand){
+	if ((operand & 0x0007) == 0)
+		SyncSTS();
 	gA = gReg->reg[((operand & 0x0078) >> 3)][(operand & 0x0007)];
 	if ((operand & 0x0007) == 0)	/* clear top 8 bits as STS reg read */
 		gA &= 0x00FF;
@@ -1229,7 +1236,6 @@ void ndfunc_exam(ushort operand){
 
 	fulladdress = (((unsigned int)gA) <<16) | (ushort)gD;
 	gT = PhysMemRead(fulladdress);
-	/* TODO:: privilege check */
 	gPC++;
 }
 
@@ -1240,7 +1246,6 @@ void ndfunc_depo(ushort operand){
 
 	fulladdress = (((unsigned int)gA) <<16) | (ushort)gD;
 	PhysMemWrite(gT,fulladdress);
-	/* TODO:: privilege check */
 	gPC++;
 }
 
@@ -1564,17 +1569,15 @@ void ndfunc_jxn(ushort operand){
 
 /* JPL
  */
-void ndfunc_jpl(ushort operand){
-	bool UseAPT;
-	ushort eff_addr;
+static inline void ndfunc_jpl_ea(ushort operand, ushort eff_addr, bool UseAPT){
 	ushort old_gPC = gPC;
 
-	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
 	gL = gPC + 1;
 	gPC = eff_addr;
 	if (DISASM)
 		disasm_userel(old_gPC,gPC);
 }
+MEMREF_HANDLERS(ndfunc_jpl)
 
 /* SKP
  * Skip instructions, this one interleaves with other instructions so might need some extra checkings.
@@ -1585,6 +1588,130 @@ void ndfunc_skp(ushort operand){
 		gPC++;
 }
 
+/*
+ * Byte access to a host page for the byte instructions. Byte b of a page
+ * is in word b>>1, the left (MSB) byte when b is even.
+ */
+static inline ushort PageGetByte(ushort *p, int b) {
+	return((b & 1) ? p[b >> 1] & 0xff : p[b >> 1] >> 8);
+}
+
+static inline void PagePutByte(ushort *p, int b, ushort v) {
+	if (b & 1)
+		p[b >> 1] = (p[b >> 1] & 0xff00) | v;
+	else
+		p[b >> 1] = (p[b >> 1] & 0x00ff) | (v << 8);
+}
+
+/*
+ * PageMoveWords - Move n words from s to d, upwards or downwards (back).
+ * memmove gives the same result unless the move runs into its own source.
+ */
+static inline void PageMoveWords(ushort *d, ushort *s, int n, int back) {
+	int i;
+	if ((back) ? (d >= s) || (d + n <= s) : (d <= s) || (s + n <= d)) {
+		memmove(d,s,n * sizeof(ushort));
+	} else if (back) {
+		for (i=n-1;i>=0;i--) d[i] = s[i];
+	} else {
+		for (i=0;i<n;i++) d[i] = s[i];
+	}
+}
+
+/*
+ * PageMoveBytes - Move n bytes from byte sb of host page sp to byte db of
+ * host page dp. The result is the same as moving one byte after the other,
+ * upwards or downwards (back), also when the two overlap.
+ */
+static void PageMoveBytes(ushort *dp, int db, ushort *sp, int sb, int n, int back) {
+	int i;
+	bool apart = (dp + ((db+n-1) >> 1) < sp + (sb >> 1)) || (sp + ((sb+n-1) >> 1) < dp + (db >> 1));
+
+	if (!((db ^ sb) & 1)) {	/* same byte in the word, so whole words can be moved */
+		if (back) {
+			if (!((db+n-1) & 1)) {	/* last byte is a left one */
+				n--;
+				PagePutByte(dp,db+n,PageGetByte(sp,sb+n));
+			}
+			PageMoveWords(dp + ((db+1) >> 1),sp + ((sb+1) >> 1),(n - (db & 1)) >> 1,1);
+			if (db & 1)
+				PagePutByte(dp,db,PageGetByte(sp,sb));
+		} else {
+			if (db & 1) {
+				PagePutByte(dp,db++,PageGetByte(sp,sb++));
+				n--;
+			}
+			PageMoveWords(dp + (db >> 1),sp + (sb >> 1),n >> 1,0);
+			if (n & 1)
+				PagePutByte(dp,db+n-1,PageGetByte(sp,sb+n-1));
+		}
+	} else if (apart) {	/* bytes have to be shifted, order does not matter */
+		if (db & 1) {
+			PagePutByte(dp,db++,PageGetByte(sp,sb++));
+			n--;
+		}
+		dp += db >> 1;
+		sp += sb >> 1;	/* sb is odd now */
+		for (i=0;i<(n >> 1);i++)
+			dp[i] = (sp[i] << 8) | (sp[i+1] >> 8);
+		if (n & 1)
+			PagePutByte(dp,n-1,PageGetByte(sp,(n-1)+1));
+	} else if (back) {
+		for (i=n-1;i>=0;i--)
+			PagePutByte(dp,db+i,PageGetByte(sp,sb+i));
+	} else {
+		for (i=0;i<n;i++)
+			PagePutByte(dp,db+i,PageGetByte(sp,sb+i));
+	}
+}
+
+/*
+ * ByteMove - The move loop of MOVB and MOVBF. Byte i is moved from byte
+ * i+s_lr counted from word address source, to byte i+d_lr from dest, with
+ * i counting up from 0, or down from len-1 if back is set.
+ * Spans within one page of both source and dest are moved directly in
+ * host memory. Where MemoryPage says no it goes byte by byte through
+ * MemoryRead and MemoryWrite, which do the faults.
+ */
+static void ByteMove(ushort source, ushort s_lr, bool s_apt, ushort dest, ushort d_lr, bool d_apt, int len, int back) {
+	int i,n,sb,db;
+	ushort addr_s,addr_d,thebyte;
+	ushort *sp, *dp;
+	bool fast = !(trace & 0x08);	/* memory trace wants every access */
+
+	i = (back) ? len-1 : 0;
+	while ((back) ? (i >= 0) : (i < len)) {
+		addr_s = source + ((i+s_lr)>>1); /* Word adress of byte to read */
+		addr_d = dest + ((i+d_lr)>>1); /* Word adress of byte to write */
+		sp = (fast) ? MemoryPage(addr_s >> 10,s_apt,false) : NULL;
+		dp = (sp) ? MemoryPage(addr_d >> 10,d_apt,true) : NULL;
+		if (dp) {
+			sb = ((addr_s & 01777) << 1) | ((i+s_lr) & 1);
+			db = ((addr_d & 01777) << 1) | ((i+d_lr) & 1);
+			if (back) {	/* down to the start of either page */
+				n = i+1;
+				if (sb+1 < n) n = sb+1;
+				if (db+1 < n) n = db+1;
+				PageMoveBytes(dp,db-n+1,sp,sb-n+1,n,1);
+				i -= n;
+			} else {	/* up to the end of either page */
+				n = len-i;
+				if (2048-sb < n) n = 2048-sb;
+				if (2048-db < n) n = 2048-db;
+				PageMoveBytes(dp,db,sp,sb,n,0);
+				i += n;
+			}
+			HEAT_N(HM_READ,sp - VolatileMemory->n_Array,n);	/* as many as byte by byte */
+			HEAT_N(HM_WRITE,dp - VolatileMemory->n_Array,n);
+			continue;
+		}
+		thebyte = MemoryRead(addr_s,s_apt);
+		thebyte = ((i+s_lr)&1) ? thebyte & 0xff : (thebyte >> 8) &0xff; /* right, LSB : left, MSB */
+		MemoryWrite(thebyte,addr_d,d_apt,((i+d_lr)&1));
+		i += (back) ? -1 : 1;
+	}
+}
+
 /* BFILL
  * IN X and T registers point to address and number of bytes.
  * A contains the byte to write
@@ -1595,7 +1722,8 @@ void ndfunc_skp(ushort operand){
  * Which means eventually we have to do this function reentrant. Yuck!! /Roger
  */
 void ndfunc_bfill(ushort operand){
-	ushort d1,d2,len,addr,i;
+	ushort d1,d2,len,addr,i,n,db;
+	ushort *dp;
 	ushort right = (gT & ((ushort)1<<15)) ? 1 : 0; /* Start with right byte? (LSB) */
 	bool is_apt = (gT & ((ushort)1<<14)) ? true : false; /* Use APT or not? */
 	ushort thebyte = gA & 0xff;
@@ -1606,9 +1734,28 @@ void ndfunc_bfill(ushort operand){
 	if (trace) trace_pre(2,"X",(int)gX,"T",(int)gT);
 	if (trace) trace_step(1,"S:(%06o)-",(int)gX);
 //	if (debug) fprintf(debugfile,"BFILL(ante): gX:%06o gT:%06o byte:%03o len:%d\n",gX,gT,thebyte,len);
-	for (i=0;i<len;i++) {
+	/* A page at a time if we can, see ByteMove */
+	i = 0;
+	while (i < len) {
 		addr = d1 + ((i+right)>>1); /* Word adress of byte to write */
+		dp = (trace & 0x08) ? NULL : MemoryPage(addr >> 10,is_apt,true);
+		if (dp) {
+			db = ((addr & 01777) << 1) | ((i+right) & 1);
+			n = len-i;
+			if (2048-db < n) n = 2048-db;
+			i += n;
+			HEAT_N(HM_WRITE,dp - VolatileMemory->n_Array,n);	/* as many as byte by byte */
+			if (db & 1) {
+				PagePutByte(dp,db++,thebyte);
+				n--;
+			}
+			memset(dp + (db >> 1),thebyte,(n >> 1) * sizeof(ushort));	/* both bytes the same */
+			if (n & 1)
+				PagePutByte(dp,db+n-1,thebyte);
+			continue;
+		}
 		MemoryWrite(thebyte,addr,is_apt,((i+right)&1));
+		i++;
 	}
 	gT &= 0x7000; /* Null number of bytes, as per manual, also null bit 15 */
 	gT |= ((i+right) & 1)<<15; /* set bit 15 to point to next free byte */
@@ -1657,25 +1804,25 @@ void ndfunc_init(ushort operand){
 		gPC+=6;
 		return;
 	}
-	if ( (flag&0x01) !=( gReg->reg[gPIL][_STS] &0x01)) {
+	if ( (flag&0x01) !=( gReg->myreg_CUR[_STS] &0x01)) {
 		gPC+=6;
 		return;
 	}
 	MemoryWrite(gL+1,start,0,2); /* L+1 ==> LINK */
-	trace_step(1,"LINK:(%06o)<=L+1",(int)start);
-	trace_step(1,"L+1=%06o",(int)gL+1);
+	if (trace) trace_step(1,"LINK:(%06o)<=L+1",(int)start);
+	if (trace) trace_step(1,"L+1=%06o",(int)gL+1);
 	MemoryWrite(gB,start+1,0,2); /* B   ==> PREVB */
-	trace_step(1,"PREVB:(%06o)<=B",(int)start+1);
-	trace_step(1,"B=%06o",(int)gB);
+	if (trace) trace_step(1,"PREVB:(%06o)<=B",(int)start+1);
+	if (trace) trace_step(1,"B=%06o",(int)gB);
 	MemoryWrite(start+maxsize,start+3,0,2); /* SMAX */
-	trace_step(1,"SMAX:(%06o)<=MAX",(int)start+3);
-	trace_step(1,"MAX=%06o",(int)start+maxsize);
-	gB = start + 128; /* + 200 oct. */
-	trace_step(1,"B<=%06o",(int)start+128);
+	if (trace) trace_step(1,"SMAX:(%06o)<=MAX",(int)start+3);
+	if (trace) trace_step(1,"MAX=%06o",(int)start+maxsize);
 	/*:TODO:  Flag */
-	MemoryWrite(gB+demand-122,start+2,0,2); /* STP */
-	trace_step(1,"STP:(%06o)<=B+demand-172",(int)start+2);
-	trace_step(1,"B+demand-172=%06o",(int)gB+demand-122);
+	MemoryWrite(start+128+demand-122,start+2,0,2); /* STP */
+	if (trace) trace_step(1,"STP:(%06o)<=B+demand-172",(int)start+2);
+	if (trace) trace_step(1,"B+demand-172=%06o",(int)start+128+demand-122);
+	gB = start + 128; /* + 200 oct., last so an aborted INIT can be restarted */
+	if (trace) trace_step(1,"B<=%06o",(int)start+128);
 	gPC+=7;
 	if (trace) trace_post(2,"gPC",gPC,"B",gB);
 /*
@@ -1699,7 +1846,7 @@ void ndfunc_init(ushort operand){
  * ADDR+3: Normal return
  */
 void ndfunc_entr(ushort operand){
-	ushort oldB,demand,smax,stp;
+	ushort newB,demand,smax,stp;
 	if (trace) trace_pre(2,"(gPC+1)",(int)MemoryRead(gPC+1,0),"(gPC+2)",(int)MemoryRead(gPC+2,0));
 	if (trace) trace_pre(1,"(gPC+3)",(int)MemoryRead(gPC+3,0));
 	demand = MemoryRead(gPC+1,0);
@@ -1709,31 +1856,35 @@ void ndfunc_entr(ushort operand){
 		return;
 	}
 	stp = MemoryRead(gB-126,0); /* STP */
-	oldB = gB;
-	gB = stp + 128; /* Advance stack frame */
-	MemoryWrite(gL+1,gB-128,0,2); /* L+1 ==> LINK */
-	MemoryWrite(oldB,gB-127,0,2); /* B   ==> PREVB */
-	MemoryWrite(smax,gB-125,0,2); /* SMAX */
-	MemoryWrite(gB+demand-122,gB-126,0,2); /* STP */
+	newB = stp + 128; /* Advance stack frame, B is set last so an aborted ENTR can be restarted */
+	MemoryWrite(gL+1,newB-128,0,2); /* L+1 ==> LINK */
+	MemoryWrite(gB,newB-127,0,2); /* B   ==> PREVB */
+	MemoryWrite(smax,newB-125,0,2); /* SMAX */
+	MemoryWrite(newB+demand-122,newB-126,0,2); /* STP */
+	gB = newB;
 	gPC+=3;
 }
 
 /* LEAVE
  */
 void ndfunc_leave(ushort operand){
-	gPC = MemoryRead(gB-128,0);
-	gB = MemoryRead(gB-127,0);
+	ushort link, prevb;
+	link = MemoryRead(gB-128,0);
+	prevb = MemoryRead(gB-127,0);
+	gPC = link;
+	gB = prevb;
 }
 
 /* ELEAV
  */
 void ndfunc_eleav(ushort operand){
-	ushort tmp;
-	tmp = MemoryRead(gB-128,0)-1;
-	MemoryWrite(tmp,gB-128,0,2); /* LINK */
+	ushort link, prevb;
+	link = MemoryRead(gB-128,0)-1;
+	prevb = MemoryRead(gB-127,0);
 	MemoryWrite(gA,gB-123,0,2); /* A ==> ERRCODE */
-	gPC = MemoryRead(gB-128,0);
-	gB = MemoryRead(gB-127,0);
+	MemoryWrite(link,gB-128,0,2); /* LINK, last so an aborted ELEAV can be restarted */
+	gPC = link;
+	gB = prevb;
 }
 
 /* LBYT
@@ -1792,17 +1943,7 @@ void ndfunc_mix3(ushort operand){
 
 
 void do_op(ushort operand){
-	ushort instr;
-	char numstr[BUFSTRSIZE];
-	char offset;
-	offset = (char)(operand & 0x00ff);
-
-	/* put offset into a string variable in octal with +/- sign for easy reading */
-	((int)offset <0) ? (void)snprintf(numstr,BUFSTRSIZE,"-%o",-(int)offset) : (void)snprintf(numstr,BUFSTRSIZE,"%o",offset);
-
-	instr=extract_opcode(operand);
-
-	instr_funcs[operand](operand);	/* call using a function pointer from the array
+	INSTR_FUNC(operand)(operand);	/* call using a function pointer from the array
 					this way we are as flexible as possible as we
 					implement io calls. */
 	prefetch();
@@ -1814,6 +1955,16 @@ void illegal_instr(ushort operand){
 	gPC++;
 }
 
+/*
+ * Privileged instruction in ring 0 or 1. Never called from the
+ * privileged handlers, it takes their place in the user ring tables.
+ */
+void priv_instr(ushort operand){
+	interrupt(14,1<<6); /* Privileged Instruction */
+	if (trace) trace_step(1,"CODE=%06o",(int)operand);
+	gPC++;
+}
+
 void unimplemented_instr(ushort operand){
 	CurrentCPURunMode = STOP; /* OK unimplemented function, lets stop CPU and end program that way */
 	gPC++;
@@ -1821,11 +1972,34 @@ void unimplemented_instr(ushort operand){
 
 void prefetch(){
 	ushort temp;
+	ushort vpn = gPC >> 10;
+
+	/*
+	 * Most of the time P is still in the page of the last fetch, and
+	 * then it is just a load. The word is read every time, so changes
+	 * to code are seen just as before.
+	 */
+	if (pf_page && (vpn == pf_vpn) && !(trace & 0x08)) {
+		gReg->myreg_PFA = (pf_page - VolatileMemory->n_Array) + (gPC & 01777);
+		gReg->myreg_PFB = pf_page[gPC & 01777];
+		HEAT(HM_FETCH,gReg->myreg_PFA);
+		return;
+	}
 	temp = MemoryFetch(gPC,false);
 	gReg->myreg_PFB = temp;
+
+	if (STS_PONI)
+		pf_page = gReg->myreg_TLB->fetch[0][vpn];	/* NULL if not mapped in */
+	else
+		pf_page = (vpn != 077) ? VolatileMemory->n_Pages[vpn] : NULL;	/* shadow memory */
+	pf_vpn = vpn;
 }
 
-void regop(ushort operand) { /* SWAP RAND REXO RORA RADD RCLR EXIT RDCR RING RSUB */
+/*
+ * Common ROP code. Only called with a constant operand from the
+ * generated regop_NNNN handlers below, so all the decoding folds away.
+ */
+static inline __attribute__((always_inline)) void regop_body(ushort operand) { /* SWAP RAND REXO RORA RADD RCLR EXIT RDCR RING RSUB */
 	int RAD,CLD,CM1,tmp;
 	ushort sr,dr,source;
 	ushort old_gPC = gPC;
@@ -1836,7 +2010,7 @@ void regop(ushort operand) { /* SWAP RAND REXO RORA RADD RCLR EXIT RDCR RING RSU
 
 	sr = ((operand & 0x0038) >> 3);
 	dr = (operand & 0x0007);
-	source = (sr==0) ? 0 : gReg->reg[CurrLEVEL][sr] & 0xFFFF; /* handles special case when sr=STS reg */
+	source = (sr==0) ? 0 : gReg->myreg_CUR[sr] & 0xFFFF; /* handles special case when sr=STS reg */
 
 	gPC++;	/* Count up first, as if P is used, it's the value of the next instruction. */
 	switch (RAD) {
@@ -1844,55 +2018,59 @@ void regop(ushort operand) { /* SWAP RAND REXO RORA RADD RCLR EXIT RDCR RING RSU
 			if (dr != 0) {
 				switch ((operand & 0x0300) >> 8) {
 					case 0: /* SWAP */
-						tmp=gReg->reg[CurrLEVEL][dr];	/* temp if we need to do the swap */
-						gReg->reg[CurrLEVEL][dr] = (CM1) ? ~source : source;
-						gReg->reg[CurrLEVEL][sr] = (CLD) ? 0 : (ushort) (tmp & 0xFFFF);
+						tmp=gReg->myreg_CUR[dr];	/* temp if we need to do the swap */
+						gReg->myreg_CUR[dr] = (CM1) ? ~source : source;
+						if (!sr)
+							SyncSTS();
+						gReg->myreg_CUR[sr] = (CLD) ? 0 : (ushort) (tmp & 0xFFFF);
+						if (!sr)
+							CacheSTS();
 						break;
 					case 1: /* RAND */
-						gReg->reg[CurrLEVEL][dr] &= (CM1) ? ~source : source;
-						gReg->reg[CurrLEVEL][dr] = (CLD) ? 0 : gReg->reg[CurrLEVEL][dr];
+						gReg->myreg_CUR[dr] &= (CM1) ? ~source : source;
+						gReg->myreg_CUR[dr] = (CLD) ? 0 : gReg->myreg_CUR[dr];
 						break;
 					case 2: /* REXO */ 
-						gReg->reg[CurrLEVEL][dr] = (CLD) ? 
+						gReg->myreg_CUR[dr] = (CLD) ? 
 							( (CM1) ? ~source : source ) :
-							( (CM1) ? gReg->reg[CurrLEVEL][dr] ^ ~source : gReg->reg[CurrLEVEL][dr] ^ source ) ;
+							( (CM1) ? gReg->myreg_CUR[dr] ^ ~source : gReg->myreg_CUR[dr] ^ source ) ;
 						break;
 					case 3: /* RORA */
-						gReg->reg[CurrLEVEL][dr] = (CLD) ? 
+						gReg->myreg_CUR[dr] = (CLD) ? 
 							( (CM1) ? ~source : source ) :
-							( (CM1) ? gReg->reg[CurrLEVEL][dr] | ~source : gReg->reg[CurrLEVEL][dr] | source ) ;
+							( (CM1) ? gReg->myreg_CUR[dr] | ~source : gReg->myreg_CUR[dr] | source ) ;
 						break;
 				}
 			}
 			break;
 		case 1 : /* Arithmetic operation - RADD RCLR EXIT RDCR RINC RSUB */
 			if (dr != 0) {
-				tmp=gReg->reg[CurrLEVEL][dr];	/* use this insted of (dr) as we need to check for carry and things */
+				tmp=gReg->myreg_CUR[dr];	/* use this insted of (dr) as we need to check for carry and things */
 				switch ((operand & 0x0380) >> 7) {
 					case 0: /* RADD */
-						tmp = (CLD) ? source : do_add(gReg->reg[CurrLEVEL][dr],source,0);
+						tmp = (CLD) ? source : do_add(gReg->myreg_CUR[dr],source,0);
 						break;
 					case 1: /* RADD CM1 */
-						tmp = (CLD) ? ~source : do_add(gReg->reg[CurrLEVEL][dr],~source,0);
+						tmp = (CLD) ? ~source : do_add(gReg->myreg_CUR[dr],~source,0);
 						break;
 					case 2: /* RADD AD1 */
-						tmp = (CLD) ? do_add(0,source,1) : do_add(gReg->reg[CurrLEVEL][dr],source,1);
+						tmp = (CLD) ? do_add(0,source,1) : do_add(gReg->myreg_CUR[dr],source,1);
 						break;
 					case 3: /* RADD AD1 CM1 */
-						tmp = (CLD) ? do_add(0,~source,1)  : do_add(gReg->reg[CurrLEVEL][dr],~source,1);
+						tmp = (CLD) ? do_add(0,~source,1)  : do_add(gReg->myreg_CUR[dr],~source,1);
 						break;
 					case 4: /* RADD ADC */
-						tmp = (CLD) ? do_add(0,source,getbit(_STS,_C)) : do_add(gReg->reg[CurrLEVEL][dr],source,getbit(_STS,_C));
+						tmp = (CLD) ? do_add(0,source,getbit(_STS,_C)) : do_add(gReg->myreg_CUR[dr],source,getbit(_STS,_C));
 						break;
 					case 5: /* RADD ADC CM1 */
-						tmp = (CLD) ? do_add(0,~source,getbit(_STS,_C)) : do_add(gReg->reg[CurrLEVEL][dr],~source,getbit(_STS,_C));
+						tmp = (CLD) ? do_add(0,~source,getbit(_STS,_C)) : do_add(gReg->myreg_CUR[dr],~source,getbit(_STS,_C));
 						break;
 					case 6: /* NOOP */
 						break;
 					case 7: /* NOOP */
 						break;
 				}
-				gReg->reg[CurrLEVEL][dr]= (ushort)( tmp &0xFFFF);
+				gReg->myreg_CUR[dr]= (ushort)( tmp &0xFFFF);
 			} else {
 				setbit(_STS,_C,0);
 			}
@@ -1904,6 +2082,47 @@ void regop(ushort operand) { /* SWAP RAND REXO RORA RADD RCLR EXIT RDCR RING RSU
 
 }
 
+/*
+ * One handler for each of the 2048 ROP encodings 0144000-0147777,
+ * regop_funcs[] is indexed by the low 11 bits of the instruction.
+ */
+#define ROP_FUNC(n)	static void regop_##n(ushort operand) { regop_body(0144000 | 0##n); }
+#define ROP_FUNC8(a,b,c)							\
+	ROP_FUNC(a##b##c##0) ROP_FUNC(a##b##c##1) ROP_FUNC(a##b##c##2) ROP_FUNC(a##b##c##3)	\
+	ROP_FUNC(a##b##c##4) ROP_FUNC(a##b##c##5) ROP_FUNC(a##b##c##6) ROP_FUNC(a##b##c##7)
+#define ROP_FUNC64(a,b)								\
+	ROP_FUNC8(a,b,0) ROP_FUNC8(a,b,1) ROP_FUNC8(a,b,2) ROP_FUNC8(a,b,3)	\
+	ROP_FUNC8(a,b,4) ROP_FUNC8(a,b,5) ROP_FUNC8(a,b,6) ROP_FUNC8(a,b,7)
+#define ROP_FUNC512(a)								\
+	ROP_FUNC64(a,0) ROP_FUNC64(a,1) ROP_FUNC64(a,2) ROP_FUNC64(a,3)		\
+	ROP_FUNC64(a,4) ROP_FUNC64(a,5) ROP_FUNC64(a,6) ROP_FUNC64(a,7)
+
+#define ROP_NAME8(a,b,c)							\
+	regop_##a##b##c##0, regop_##a##b##c##1, regop_##a##b##c##2, regop_##a##b##c##3,	\
+	regop_##a##b##c##4, regop_##a##b##c##5, regop_##a##b##c##6, regop_##a##b##c##7
+#define ROP_NAME64(a,b)								\
+	ROP_NAME8(a,b,0), ROP_NAME8(a,b,1), ROP_NAME8(a,b,2), ROP_NAME8(a,b,3),	\
+	ROP_NAME8(a,b,4), ROP_NAME8(a,b,5), ROP_NAME8(a,b,6), ROP_NAME8(a,b,7)
+#define ROP_NAME512(a)								\
+	ROP_NAME64(a,0), ROP_NAME64(a,1), ROP_NAME64(a,2), ROP_NAME64(a,3),	\
+	ROP_NAME64(a,4), ROP_NAME64(a,5), ROP_NAME64(a,6), ROP_NAME64(a,7)
+
+ROP_FUNC512(0)
+ROP_FUNC512(1)
+ROP_FUNC512(2)
+ROP_FUNC512(3)
+
+void (*regop_funcs[2048])(ushort) = {
+	ROP_NAME512(0), ROP_NAME512(1), ROP_NAME512(2), ROP_NAME512(3)
+};
+
+/*
+ * Generic ROP entry, for callers that have a ROP instruction word in hand.
+ */
+void regop(ushort operand) {
+	regop_funcs[operand & 03777](operand);
+}
+
 /* Calculates the effective address to use.
  * Uses MemoryRead to do this so we get the Page Table handling
  * done correctly.
@@ -2006,10 +2225,10 @@ ushort New_GetEffectiveAddr(ushort instr, bool *use_apt) {
  * NOTE:: STS need to be checked.
  */
 void DoMCL(ushort instr) {
-	int s;
 	switch(instr & 0x0F) {
 	case 01:
-		gReg->reg[CurrLEVEL][0] &= ~(gA & 0x00FF);
+		SyncSTS();
+		gReg->myreg_CUR[0] &= ~(gA & 0x00FF);
 //		ushort reg_a = gA;
 //		SystemSTS &= ~(reg_a & 0xF000);
 //		gReg->reg[CurrLEVEL][0] &= ~(reg_a & 0x00FF);
@@ -2018,12 +2237,7 @@ void DoMCL(ushort instr) {
 		/* This affects interrupt, so do locking and checking. */
 		if (trace) trace_pre(2,"PID",gPID,"A",gA);
 
-		gPID &= ~gA;
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
-
+		__atomic_and_fetch(&gPID,~gA,__ATOMIC_SEQ_CST);
 		checkPK();
 		if (trace) trace_step(1,"PID {AND}{NOT} A",0);
 		if (trace) trace_post(1,"PID",gPID);
@@ -2031,13 +2245,7 @@ void DoMCL(ushort instr) {
 	case 07:
 		/* This affects interrupt, so do locking and checking. */
 		if (trace) trace_pre(2,"PIE",gPIE,"A",gA);
-		while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-			continue; /* Restart if interrupted by handler */
-		gPIE &= ~gA;
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
+		__atomic_and_fetch(&gPIE,~gA,__ATOMIC_SEQ_CST);
 		checkPK();
 		if (trace) trace_step(1,"PIE {AND}{NOT} A",0);
 		if (trace) trace_post(1,"PIE",gPIE);
@@ -2058,10 +2266,10 @@ void DoMCL(ushort instr) {
  * NOTE:: STS need to be checked.
  */
 void DoMST(ushort instr) {
-	int s;
 	switch(instr & 0x0F) {
 	case 01:
-		gReg->reg[CurrLEVEL][0] |= (gA & 0x00ff);
+		SyncSTS();
+		gReg->myreg_CUR[0] |= (gA & 0x00ff);
 //		ushort reg_a = gA;
 //		SystemSTS |= reg_a & 0xF000;
 //		gReg->reg[CurrLEVEL][0] |= reg_a & 0x00FF;
@@ -2069,13 +2277,7 @@ void DoMST(ushort instr) {
 	case 06:
 		/* This affects interrupt, so do locking and checking. */
 		if (trace) trace_pre(2,"PID",gPID,"A",gA);
-		while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-			continue; /* Restart if interrupted by handler */
-		gPID |= gA;
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
+		__atomic_or_fetch(&gPID,gA,__ATOMIC_SEQ_CST);
 		checkPK();
 		if (trace) trace_step(1,"PID {AND}{NOT} A",0);
 		if (trace) trace_post(1,"PID",gPID);
@@ -2083,13 +2285,7 @@ void DoMST(ushort instr) {
 	case 07:
 		/* This affects interrupt, so do locking and checking. */
 		if (trace) trace_pre(2,"PIE",gPIE,"A",gA);
-		while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-			continue; /* Restart if interrupted by handler */
-		gPIE |= gA;
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
+		__atomic_or_fetch(&gPIE,gA,__ATOMIC_SEQ_CST);
 		checkPK();
 		if (trace) trace_step(1,"PIE {AND}{NOT} A",0);
 		if (trace) trace_post(1,"PIE",gPIE);
@@ -2152,9 +2348,7 @@ void DoCLEPT() {
  *  A = <IR>;
  */
 void DoTRA(ushort instr) {
-	int s;
 	ushort temp,level;
-	ushort i;
 	switch(instr & 0x0F) {
 	case 00: /* TRA PANS */
 		gA = gPANS;
@@ -2162,7 +2356,8 @@ void DoTRA(ushort instr) {
 		if (debug) fprintf(debugfile,"TRA PANS: A <= %06o\n",gA);
 		break;
 	case 01: /* TRA STS */
-		gA= gReg->reg[gPIL][_STS]; /* If everything is done correctly elsewhere this should work fine */
+		SyncSTS();
+		gA= gReg->myreg_CUR[_STS]; /* If everything is done correctly elsewhere this should work fine */
 		if (trace) trace_step(1,"A<=STS",0);
 		break;
 	case 02: /* TRA OPR */
@@ -2172,14 +2367,8 @@ void DoTRA(ushort instr) {
 		break;
 	case 03: /* TRA PGS */
 		/* TODO:: Check that this also is supposed to clear the PGS as it "unlocks" it */
-		while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-			continue; /* Restart if interrupted by handler */
-		gA = gPGS;
+		gA = gPGS;	/* only the cpu thread touches PGS */
 		gPGS=0;
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
 		if (trace) trace_step(1,"A<=PGS",0);
 		break;
 	case 04: /* TRA PVL */
@@ -2191,20 +2380,10 @@ void DoTRA(ushort instr) {
 	case 05: /* TRA IIC */
 		/* Manuals says(2.2.4.3) that this should be a number equal to the highest bit set in (IID & IIE) - Roger */
 		/* Only bit 1-10 is used, so we only return a value between 1 and 10  or else  zero */
-		while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-			continue; /* Restart if interrupted by handler */
-		gIIC = 0;
-		temp=gIID & gIIE;
-		for (i=1;i<16;i++) {
-			gIIC = ((1<<i) & temp) ? i : gIIC;
-		}
+		temp = __atomic_exchange_n(&gIID,0,__ATOMIC_SEQ_CST) & gIIE & 0xfffe;
+		gIIC = (temp) ? 31 - __builtin_clz(temp) : 0;	/* highest bit set */
 		gA = gIIC;
-		gIID = 0;
 		gReg->mylock_IIC = false;
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
 		if (trace) trace_step(1,"A<=IIC",0);
 		break;
 	case 06:
@@ -2252,7 +2431,7 @@ void DoEXR(ushort instr) {
 	char disasm_str[256];
 	sr = (instr >> 3) & 0x07;
 	if(sr)
-		exr_instr = gReg->reg[CurrLEVEL][sr];
+		exr_instr = gReg->myreg_CUR[sr];
 	else
 		exr_instr = 0;
 	if (trace & 0x01) {
@@ -2279,10 +2458,9 @@ void DoEXR(ushort instr) {
 /*
  * DoWAIT - Give up prio instruction
  * NOTE:: Only basic parts fixed yet, this is a fairly complex one
- * Also no privilege checks are done as of yet.
+ * Privilege is checked by the ring dispatch tables, see CacheSTS.
  */
 void DoWAIT(ushort instr) {
-	int s;
 	ushort temp;
 	if(!STS_IONI) { /* Interrupt is off, HALT cpu */
 		gPC++;
@@ -2294,13 +2472,7 @@ void DoWAIT(ushort instr) {
 	} else {
 		gPC++;
 		temp= ~(1<<CurrLEVEL); /* Now we have a 0 in the position we want */
-		while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-			continue; /* Restart if interrupted by handler */
-		gPID &= temp; /* Give up this level */
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
+		__atomic_and_fetch(&gPID,temp,__ATOMIC_SEQ_CST); /* Give up this level */
 		checkPK();
 	}
 }
@@ -2313,7 +2485,6 @@ void DoWAIT(ushort instr) {
  * NOTE: STS and PCR NOT fixed yet!!!
  */
 void DoTRR(ushort instr) {
-	int s;
 	ushort temp,level;
 	if (trace) trace_pre(1,"A",(int)gA);
 	switch(instr & 0x0F) {
@@ -2330,7 +2501,8 @@ void DoTRR(ushort instr) {
 		break;
 	case 01:
 		/* ND-06.029.1 ND-110 Instruction Set, lists only lower 8 bits as changeable... */
-		gReg->reg[CurrLEVEL][_STS] = (gReg->reg[CurrLEVEL][_STS] & 0xff00) | (gA & 0x00ff); /* Only change LSB  */
+		SyncSTS();
+		gReg->myreg_CUR[_STS] = (gReg->myreg_CUR[_STS] & 0xff00) | (gA & 0x00ff); /* Only change LSB  */
 		if (trace) trace_step(1,"STS(LSB)<=A",0);
 		break;
 	case 02:
@@ -2342,40 +2514,25 @@ void DoTRR(ushort instr) {
 		temp = gA;
 		level = (temp >> 3) & 0x0f;
 		gReg->reg_PCR[level]= temp & 0x0783; /* Mask out so we only get PT, APT, RING as per Manual*/
+		TlbFlushLevel(level);
+		if (level == CurrLEVEL)
+			CacheSTS();	/* Ring may have changed */
 		if (trace) trace_step(1,"PCR(%d)<=A",level);
 		break;
 	case 05:
-		while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-			continue; /* Restart if interrupted by handler */
 		gIIE = gA;
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
 		checkPK();
 		if (trace) trace_step(1,"IIE<=A",0);
 		break;
 	case 06:
 		/* This affects interrupt, so do locking and checking. */
-		while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-			continue; /* Restart if interrupted by handler */
-		gPID = gA;
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
+		__atomic_store_n(&gPID,gA,__ATOMIC_SEQ_CST);
 		checkPK();
 		if (trace) trace_step(1,"PID<=A",0);
 		break;
 	case 07:
 		/* This affects interrupt, so do locking and checking. */
-		while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-			continue; /* Restart if interrupted by handler */
-		gPIE = gA;
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
+		__atomic_store_n(&gPIE,gA,__ATOMIC_SEQ_CST);
 		checkPK();
 		if (trace) trace_step(1,"PIE<=A",0);
 		break;
@@ -2413,6 +2570,7 @@ void DoSRB(ushort operand) {
 
 	if (trace) trace_pre(1,"X",(int)gX);
 
+	SyncSTS();
 	temp = gReg->reg[lvl][_STS] & 0x00ff;
 
 	MemoryWrite(gReg->reg[lvl][_P],addr,false,2);
@@ -2470,6 +2628,7 @@ void DoLRB(ushort operand) {
 
 	if (trace) trace_pre(1,"X",(int)gX);
 
+	SyncSTS();
 	if (lvl != CurrLEVEL) {	/* Dont change P on current level if this happens to be specified */
 		gReg->reg[lvl][_P]   = MemoryRead(addr,false);
 		if (trace) {
@@ -2521,8 +2680,8 @@ bool IsSkip(ushort instr) {
 	char z, o, c, s;
 	sr = (instr >> 3) & 0x07;
 	dr = (instr >> 0) & 0x07;
-	source = (0 == sr) ? 0 : gReg->reg[CurrLEVEL][sr]; /* Never use STS reg but zero value instead */
-	desti  = (0 == dr) ? 0 : gReg->reg[CurrLEVEL][dr]; /* Never use STS reg but zero value instead */
+	source = (0 == sr) ? 0 : gReg->myreg_CUR[sr]; /* Never use STS reg but zero value instead */
+	desti  = (0 == dr) ? 0 : gReg->myreg_CUR[dr]; /* Never use STS reg but zero value instead */
 	ss = (signed short)source;
 	sd = (signed short)desti;
 
@@ -2579,7 +2738,7 @@ void do_bops(ushort operand) {
 	gPC++;
 	bn = ((operand & 0x0078) >> 3);
 	dr = (operand & 0x0007);
-	if (trace) trace_pre(1,regn[dr],gReg->reg[CurrLEVEL][dr]);
+	if (trace) trace_pre(1,regn[dr],gReg->myreg_CUR[dr]);
 	switch (( operand & 0x0780) >> 7) {
 	case 0 : /* BSET ZRO */
 		setbit(dr,bn,0);
@@ -2635,7 +2794,7 @@ void do_bops(ushort operand) {
 		break;
 	}
 	if (trace) {
-		(void)snprintf(trace_temp_str,255,"%s=%06o",regn[dr],gReg->reg[CurrLEVEL][dr]);
+		(void)snprintf(trace_temp_str,255,"%s=%06o",regn[dr],gReg->myreg_CUR[dr]);
 		trace_step(1,(char *)trace_temp_str,0);
 	}
 }
@@ -2740,7 +2899,6 @@ void DoMOVB(ushort instr) {
 	ushort source,dest,lens,lend,len,s_lr,d_lr,s_apt,d_apt;
 	int dir; /* direction, 0=low to high, 1 = high to low */
 	int i;
-	ushort thebyte;
 	ushort addr_d, addr_s;
 
 	addr_d = 0;
@@ -2764,25 +2922,14 @@ void DoMOVB(ushort instr) {
 		dir = 0;
 	}
 //	if (debug) fprintf(debugfile,"MOVB(ante): gA:%06o gD:%06o gX:%06o gT:%06o len:%d\n",gA,gD,gX,gT,len);
-	/* COPY */
-	if (dir) { /* high to low */
-		for (i=len-1;i>=0;i--) {
-			addr_s = source + ((i+s_lr)>>1); /* Word adress of byte to read */
-			thebyte = MemoryRead(addr_s,s_apt);
-			thebyte = ((i+d_lr)&1) ? thebyte : (thebyte >> 8) &0xff; /* right, LSB : left, MSB */
-			addr_d = dest + ((i+d_lr)>>1); /* Word adress of byte to write */
-			MemoryWrite(thebyte,addr_d,d_apt,((i+d_lr)&1));
-		}
-		i=0;
-	} else { /* low to high */
-		for (i=0;i<len;i++) {
-			addr_s = source + ((i+s_lr)>>1); /* Word adress of byte to read */
-			thebyte = MemoryRead(addr_s,s_apt);
-			thebyte = ((i+d_lr)&1) ? thebyte : (thebyte >> 8) &0xff; /* right, LSB : left, MSB */
-			addr_d = dest + ((i+d_lr)>>1); /* Word adress of byte to write */
-			MemoryWrite(thebyte,addr_d,d_apt,((i+d_lr)&1));
-		}
+	/* COPY, high to low or low to high */
+	ByteMove(source,s_lr,s_apt,dest,d_lr,d_apt,len,dir);
+	if (len) {	/* word addresses of the last byte moved */
+		i = (dir) ? 0 : len-1;
+		addr_s = source + ((i+s_lr)>>1);
+		addr_d = dest + ((i+d_lr)>>1);
 	}
+	i = (dir) ? 0 : len;
 
 	gD &= 0x7000; /* Null number of bytes, as per manual, also null bit 15 */
 	gT &= 0x7000; /* Null number of bytes, also null bit 15 */
@@ -2805,7 +2952,6 @@ void DoMOVB(ushort instr) {
 void DoMOVBF(ushort instr) {
 	ushort source,dest,lens,lend,len,s_lr,d_lr,s_apt,d_apt;
 	int i;
-	ushort thebyte;
 	ushort addr_d, addr_s;
 	source=gA;
 	dest=gX;
@@ -2833,15 +2979,14 @@ void DoMOVBF(ushort instr) {
 	if (debug) fprintf(debugfile,"MOVBF(dec): gA:%06d gD:%06d gX:%06d gT:%06d gPC:%06d len:%06d\n",gA,gD,gX,gT,gPC,len);
 	if (debug) fprintf(debugfile,"MOVBF(pre): overlap=%d\n",overlap);
 
-	for (i=0;i<len;i++) {
-		addr_s = source + ((i+s_lr)>>1); /* Word adress of byte to read */
-		thebyte = MemoryRead(addr_s,s_apt);
-		thebyte = ((i+d_lr)&1) ? thebyte : (thebyte >> 8) &0xff; /* right, LSB : left, MSB */
-		addr_d = dest + ((i+d_lr)>>1); /* Word adress of byte to write */
-		MemoryWrite(thebyte,addr_d,d_apt,((i+d_lr)&1));
-		lens--;
-		lend--;
+	ByteMove(source,s_lr,s_apt,dest,d_lr,d_apt,len,0);
+	if (len) {	/* word addresses of the last byte moved */
+		addr_s = source + ((len-1+s_lr)>>1);
+		addr_d = dest + ((len-1+d_lr)>>1);
 	}
+	i = len;
+	lens -= len;
+	lend -= len;
 
 	gA = source + ((len+s_lr)>>1);
 	gX = dest + ((len+d_lr)>>1);
@@ -2865,6 +3010,131 @@ void DoMOVBF(ushort instr) {
 	return;
 }
 
+/* TSET
+ * Test and set, for semaphores shared with other cpus.
+ * A:=(T), (T):=177777
+ */
+void ndfunc_tset(ushort operand){
+	ushort value;
+	if (trace) trace_pre(2,"A",(int)gA,"T",(int)gT);
+	value = MemoryRead(gT,false);
+	MemoryWrite(0177777,gT,false,2);
+	gA = value;
+	gPC++;
+	if (trace) trace_post(1,"A",(int)gA);
+}
+
+/* RDUS
+ * Read without using the cache, A:=(T). We have no cache, so a plain read.
+ */
+void ndfunc_rdus(ushort operand){
+	ushort value;
+	if (trace) trace_pre(2,"A",(int)gA,"T",(int)gT);
+	value = MemoryRead(gT,false);
+	gA = value;
+	gPC++;
+	if (trace) trace_post(1,"A",(int)gA);
+}
+
+/* Address spaces of MOVEW, for source and destination */
+#define MOVEW_PT	0
+#define MOVEW_APT	1
+#define MOVEW_PHYS	2
+
+static const unsigned char movew_space[9][2] = {
+	{ MOVEW_PT,   MOVEW_PT },	/* 0 */
+	{ MOVEW_PT,   MOVEW_APT },	/* 1 */
+	{ MOVEW_APT,  MOVEW_PT },	/* 2 */
+	{ MOVEW_APT,  MOVEW_APT },	/* 3 */
+	{ MOVEW_PT,   MOVEW_PHYS },	/* 4 */
+	{ MOVEW_APT,  MOVEW_PHYS },	/* 5 */
+	{ MOVEW_PHYS, MOVEW_PT },	/* 6 */
+	{ MOVEW_PHYS, MOVEW_APT },	/* 7 */
+	{ MOVEW_PHYS, MOVEW_PHYS }	/* 10 */
+};
+
+/*
+ * MovewPage - Host address of the page holding word addr in one of the
+ * MOVEW address spaces, with *left set to the number of words from addr
+ * to the end of that page. NULL if the word has to be accessed one at a
+ * time, see MemoryPage. Physical pages are turned down for the same
+ * reasons: shadow memory, or a write to a page with cached code.
+ */
+static ushort *MovewPage(ulong addr, int space, bool write, int *left) {
+	*left = 1024 - (addr & 01777);
+	if (trace & 0x08)
+		return(NULL);	/* memory trace wants every access */
+	if (space == MOVEW_PHYS) {
+		if (IsShadowMemAccess(addr & ~(ulong)01777) || IsShadowMemAccess(addr | 01777))
+			return(NULL);
+		addr &= (ND_Memsize - 1);
+		if (write && bc_pagemap[addr >> 10])
+			return(NULL);
+		return(VolatileMemory->n_Pages[addr >> 10]);
+	}
+	return(MemoryPage((addr >> 10) & 077,(space == MOVEW_APT),write));
+}
+
+/* MOVEW
+ * Move L words from D to X, both logical, or physical with A and T as the
+ * upper halves of the address. The low 6 bits select the address spaces,
+ * see movew_space[]. Physical memory is only allowed from ring 2 and 3.
+ * D, X (and A, T) are counted up and L down as the words are moved, so
+ * if an access aborts the instruction it goes on from there when rerun.
+ * A page at a time if we can, see ByteMove.
+ */
+void ndfunc_movew(ushort operand){
+	int sub = operand & 077;
+	int s_space,d_space,n,sn,dn;
+	ulong src,dst;
+	ushort *sp, *dp;
+	ushort value;
+
+	if (sub > 010) {
+		illegal_instr(operand);
+		return;
+	}
+	s_space = movew_space[sub][0];
+	d_space = movew_space[sub][1];
+	if (((s_space == MOVEW_PHYS) || (d_space == MOVEW_PHYS)) &&
+	    STS_PONI && ((gReg->reg_PCR[CurrLEVEL] & 0x03) < 2)) {
+		priv_instr(operand);
+		return;
+	}
+	if (trace) trace_pre(3,"D",(int)gD,"X",(int)gX,"L",(int)gL);
+
+	while (gL) {
+		src = (s_space == MOVEW_PHYS) ? ((ulong)gA << 16) | gD : gD;
+		dst = (d_space == MOVEW_PHYS) ? ((ulong)gT << 16) | gX : gX;
+		sp = MovewPage(src,s_space,false,&sn);
+		dp = (sp) ? MovewPage(dst,d_space,true,&dn) : NULL;
+		if (dp) {
+			n = gL;
+			if (sn < n) n = sn;
+			if (dn < n) n = dn;
+			PageMoveWords(dp + (dst & 01777),sp + (src & 01777),n,0);
+			HEAT_N(HM_READ,sp - VolatileMemory->n_Array,n);
+			HEAT_N(HM_WRITE,dp - VolatileMemory->n_Array,n);
+		} else {
+			n = 1;
+			value = (s_space == MOVEW_PHYS) ? PhysMemRead(src) : MemoryRead(gD,(s_space == MOVEW_APT));
+			if (d_space == MOVEW_PHYS)
+				PhysMemWrite(value,dst);
+			else
+				MemoryWrite(value,gX,(d_space == MOVEW_APT),2);
+		}
+		src += n;
+		dst += n;
+		if (s_space == MOVEW_PHYS) gA = src >> 16;
+		if (d_space == MOVEW_PHYS) gT = dst >> 16;
+		gD = src;
+		gX = dst;
+		gL -= n;
+	}
+	gPC++;
+	if (trace) trace_post(3,"D",(int)gD,"X",(int)gX,"L",(int)gL);
+}
+
 void add_A_mem(ushort eff_addr, bool UseAPT) {
 	int temp, data, oldreg;
 	oldreg = gA;
@@ -2929,7 +3199,7 @@ void rdiv(ushort instr){
 	/* :TODO: Apparently Carry can be set too. CHECK that... Might be RAD=1??? */
 	/* Overflow and division with zero also need to be fixed!! */
 	/* :NOTE: The way it is described in the manual, we assume this is a fraction (numerator/denominator and return a quotient and remainder as per manual */
-	divider = ((instr & 0x0038) >> 3) ? (sshort)gReg->reg[gPIL][((instr & 0x0038) >> 3)] : 0;
+	divider = ((instr & 0x0038) >> 3) ? (sshort)gReg->myreg_CUR[((instr & 0x0038) >> 3)] : 0;
 	dividend = ((int)gA << 16) | gD;
 	result3 = div(dividend,divider);
 	gA = result3.quot;
@@ -2944,8 +3214,8 @@ void rdiv(ushort instr){
 void rmpy(ushort instr){
 	/* :TODO: Apparently Carry can be set too. CHECK that... Might be RAD=1??? */
 	int a,b,result;
-	a = ((instr & 0x0038) >> 3) ? (int) gReg->reg[gPIL][((instr & 0x0038) >> 3)] : 0;
-	b = (instr & 0x0007) ? (int) gReg->reg[gPIL][(instr & 0x0007)] : 0;
+	a = ((instr & 0x0038) >> 3) ? (int) gReg->myreg_CUR[((instr & 0x0038) >> 3)] : 0;
+	b = (instr & 0x0007) ? (int) gReg->myreg_CUR[(instr & 0x0007)] : 0;
 	result = a * b;
 	if (abs(result) > INT_MAX) { /* Set O and Q */
 		setbit(_STS,_Q,1);
@@ -2964,11 +3234,8 @@ void rmpy(ushort instr){
 /*
  * MPY
  */
-void mpy(ushort instr){
-	bool UseAPT;
+static inline void mpy_ea(ushort instr, ushort eff_addr, bool UseAPT){
 	int a,b,result;
-	ushort eff_addr;
-	eff_addr = New_GetEffectiveAddr(instr,&UseAPT);
 	a = (sshort)gA;
 	b = (sshort)MemoryRead(eff_addr,UseAPT);
 	result = a * b;
@@ -2984,21 +3251,28 @@ void mpy(ushort instr){
 	gPC++;
 	return;
 }
+MEMREF_HANDLERS(mpy)
 
 void setreg(int r, int val) { /* FIXME - kolla upp flaggor */
-	gReg->reg[CurrLEVEL][r]=(ushort) (val & 0xFFFF);
+	gReg->myreg_CUR[r]=(ushort) (val & 0xFFFF);
 }
 
 ushort getbit(ushort regnum, ushort stsbit) {
 	ushort result;
-	result=((gReg->reg[CurrLEVEL][regnum] >> stsbit) & 1);
+	if ((regnum == _STS) && ((1 << stsbit) & STS_LAZY) && gReg->lazy_sts)
+		SyncSTS();
+	result=((gReg->myreg_CUR[regnum] >> stsbit) & 1);
 	return result;
 }
 
 void clrbit(ushort regnum, ushort stsbit) {
 	ushort thebit;
+	if ((regnum == _STS) && ((1 << stsbit) & (STS_LAZY | (0x0f << _PL))) && gReg->lazy_sts)
+		SyncSTS();
 	thebit=(1 << stsbit) ^ 0xFFFF;
-	gReg->reg[CurrLEVEL][regnum] = (thebit & gReg->reg[CurrLEVEL][regnum]);
+	gReg->myreg_CUR[regnum] = (thebit & gReg->myreg_CUR[regnum]);
+	if ((regnum == _STS) && (stsbit >= _PL))
+		CacheSTS();
 }
 
 /*
@@ -3020,62 +3294,133 @@ void setbit_STS_MSB(ushort stsbit, char val) {
 		for(i=0;i<=15;i++)
 			gReg->reg[i][_STS] = gReg->reg[i][_STS] & thebit;
 	}
-
-
+	CacheSTS();
 }
 
 void setPIL(char val) {
 	int i;
+	SyncSTS();	/* flags belong to the level we are leaving */
 	for(i=0;i<=15;i++){
 		gReg->reg[i][_STS] &= 0xf0ff; /* clear PIL bits first */
 		gReg->reg[i][_STS] = gReg->reg[i][_STS] | ((val & 0x0f)<<8);
 	}
+	CacheSTS();
+}
+
+/*
+ * TlbFlush - Empty the TLBs of all levels.
+ * Needed when paging or extended addressing is turned on or off, or
+ * when the page tables are changed other than through PT_Write.
+ */
+void TlbFlush(void) {
+	memset(cpu_tlb,0,sizeof(cpu_tlb));
+	pf_page = NULL;
+}
+
+/*
+ * TlbFlushLevel - Empty the TLB of one level, when its PCR is changed.
+ */
+void TlbFlushLevel(ushort level) {
+	memset(&cpu_tlb[level],0,sizeof(cpu_tlb[level]));
+	pf_page = NULL;
+}
+
+/*
+ * TlbInvalidate - Page table entry vpn of page table pt_num has been
+ * changed. Drop it from the TLB of every level using that table.
+ */
+static void TlbInvalidate(ushort pt_num, ushort vpn) {
+	int level, sel;
+	ushort pcr;
+	for (level=0;level<16;level++) {
+		pcr = gReg->reg_PCR[level];
+		for (sel=0;sel<2;sel++) {
+			if ((((sel) ? (pcr>>7) : (pcr>>9)) & 0x03) == pt_num) {	/* APT : PT */
+				cpu_tlb[level].read[sel][vpn] = NULL;
+				cpu_tlb[level].write[sel][vpn] = NULL;
+				cpu_tlb[level].fetch[sel][vpn] = NULL;
+			}
+		}
+	}
+	pf_page = NULL;
+}
+
+/*
+ * CacheSTS - Update the STS MSB shortcuts in gReg.
+ * Called by setPIL and setbit_STS_MSB, and by anything else that
+ * might have changed the MSB of level 0 STS.
+ */
+void CacheSTS(void) {
+	ushort level;
+	gReg->myreg_MSB = gReg->reg[0][_STS] & 0xff00;
+	level = (gReg->myreg_MSB & 0x0f00) >> 8;
+	gReg->myreg_CUR = gReg->reg[level];
+	gReg->myreg_TLB = &cpu_tlb[level];
+	pf_page = NULL;	/* may be another level, ring or mapping */
+	if ((gReg->myreg_MSB ^ tlb_msb) & ((1<<_PONI) | (1<<_SEXI))) {	/* PON, POF, SEX or REX */
+		tlb_msb = gReg->myreg_MSB;
+		TlbFlush();
+	}
+	/* Rings 0 and 1 may not use privileged instructions, but only with memory management on */
+	gReg->myreg_DISP = ((gReg->myreg_MSB & (1<<_PONI)) && ((gReg->reg_PCR[level] & 0x03) < 2)) ?
+		DISP_USER : DISP_SYSTEM;
 }
 
 void setbit(ushort regnum, ushort stsbit, char val) {
 	ushort thebit = 0;
+	/* PIL is in STS of level 0, so a BSET there may change level under us */
+	if ((regnum == _STS) && ((1 << stsbit) & (STS_LAZY | (0x0f << _PL))) && gReg->lazy_sts)
+		SyncSTS();
 	if (val) {
 		thebit=(1 << stsbit);
-		gReg->reg[CurrLEVEL][regnum] = (thebit | gReg->reg[CurrLEVEL][regnum]);
+		gReg->myreg_CUR[regnum] = (thebit | gReg->myreg_CUR[regnum]);
 	} else {
 		thebit=(1 << stsbit) ^ 0xFFFF;
-		gReg->reg[CurrLEVEL][regnum] = (thebit & gReg->reg[CurrLEVEL][regnum]);
+		gReg->myreg_CUR[regnum] = (thebit & gReg->myreg_CUR[regnum]);
 	}
+	if ((regnum == _STS) && (stsbit >= _PL))	/* on level 0 this is the MSB */
+		CacheSTS();
+}
+
+/*
+ * SyncSTS - Put C, O and Q from the adds done since last time into STS.
+ * do_add only records its result, most of the time the next add
+ * overwrites the flags before anyone has looked at them. Everything
+ * reading or writing those bits of the current level STS directly must
+ * call this first, getbit/setbit/clrbit do it themselves.
+ */
+void SyncSTS(void) {
+	ushort sts;
+	if (!gReg->lazy_sts)
+		return;
+	sts = gReg->myreg_CUR[_STS] & ~((1<<_C) | (1<<_Q));
+	if (gReg->lazy_res & 0xffff0000)	/* C (carry) */
+		sts |= (1<<_C);
+	if (gReg->lazy_q & (1<<15))		/* Q (dynamic overflow) */
+		sts |= (1<<_Q);
+	if (gReg->lazy_o & (1<<15))		/* O (static overflow), never cleared here */
+		sts |= (1<<_O);
+	gReg->myreg_CUR[_STS] = sts;
+	gReg->lazy_o = 0;
+	gReg->lazy_sts = false;
 }
 
 ushort do_add(ushort a, ushort b, ushort k) {
 	int tmp;
-	bool is_diff;
 	tmp = ((int)a) + ((int)b) + ((int)k);
-	/* C (carry) */
-	if (tmp & 0xffff0000)
-		setbit(_STS,_C,1);
-	else
-		setbit(_STS,_C,0);
-	/* O(static overflow), Q (dynamic overflow) */
-	is_diff = (((1<<15)&a)^((1<<15)&b)); /* is bit 15 of the two operands different? */
-	if(!(is_diff) && (((1<<15)&a)^((1<<15)&tmp))) { /* if equal and result is different... */
-		setbit(_STS,_O,1);
-		setbit(_STS,_Q,1);
-	} else
-		setbit(_STS,_Q,0);
+	/* overflow if bit 15 of the operands is equal and the result differs */
+	gReg->lazy_res = tmp;
+	gReg->lazy_q = ~(a ^ b) & (a ^ tmp);
+	gReg->lazy_o |= gReg->lazy_q;
+	gReg->lazy_sts = true;
 	return (ushort)tmp;
 }
 
 void AdjustSTS(ushort reg_a, ushort operand, int result) {
-	/* C (carry) */
-	if(result > 0xFFFF)
-		setbit(_STS,_C,1);
-	else
-		setbit(_STS,_C,0);
-
-	/* O(static overflow), Q (dynamic overflow) */
-	if(!(((1<<15) & reg_a)^((1<<15) & operand)) && (((1<<15) & reg_a)^((1<<15) & result))) {
-		setbit(_STS,_O,1);
-		setbit(_STS,_Q,1);
-
-	} else
-		setbit(_STS,_Q,0);
+	gReg->lazy_res = result;
+	gReg->lazy_q = ~(reg_a ^ operand) & (reg_a ^ result);
+	gReg->lazy_o |= gReg->lazy_q;
+	gReg->lazy_sts = true;
 }
 
 /*
@@ -3215,49 +3560,52 @@ void mopc_thread(){
 
 /*
  * Change PK if conditions for it's setting are right.
- *
+ * Only called from the cpu thread, other threads use PostEvent(EVT_PK).
  */
 void checkPK() {
-	int s;
-	ushort lvl;
 	ushort i;
-	gPK=0;
-	while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-		continue; /* Restart if interrupted by handler */
-	i = gPIE & gPID;
-//	if (debug) fprintf(debugfile,"PT DEB CheckPK: gPIE=%06o gPID=%06o i=%06o gPK=%d gPIL=%d\n",gPIE,gPID,i,gPK,gPIL);
-	if (i) { /* Do we have a pending interupt condition */
-		for (lvl=1;lvl<16;lvl++) {
-			gPK = (i & 1<<lvl) ? lvl : gPK; /* Will retain highest bit set as level*/
-//			if (debug) fprintf(debugfile,"PT DEB CheckPK: lvl=%d gPK=%d gPIL=%d\n",lvl,gPK,gPIL);
-		}
-	}
-	if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-		if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-		CurrentCPURunMode = SHUTDOWN;
-	}
+	i = __atomic_load_n(&gPIE,__ATOMIC_SEQ_CST) & __atomic_load_n(&gPID,__ATOMIC_SEQ_CST) & 0xfffe;
+	gPK = (i) ? 31 - __builtin_clz(i) : 0; /* Highest bit set as level, if any pending */
+	bc_break = 1;	/* Let a running block end so the new PK is looked at */
+}
+
+/*
+ * PostEvent - Tell the cpu loop there is something to look at.
+ * Wait-free, so safe from any thread. The cpu loop picks it up with
+ * DoEvents after the current instruction or block.
+ */
+void PostEvent(int evt) {
+	__atomic_or_fetch(&cpu_events,evt,__ATOMIC_SEQ_CST);
+	bc_break = 1;
+}
+
+/*
+ * DoEvents - Handle what has been posted with PostEvent, cpu thread only.
+ */
+void DoEvents(void) {
+	int evt = __atomic_exchange_n(&cpu_events,0,__ATOMIC_SEQ_CST);
+	if (evt & EVT_PK)
+		checkPK();
+	if (evt & EVT_HEATMAP)
+		HeatmapDump();
+	if (evt & EVT_WATCH)
+		WatchEvents();
 }
 
 /*
  * Main interruptsetting routine.
  * IN: interrupt level and possible subbitfield
  * for those levels that has that. (LVL 14).
+ * Lock free, PID and IID are only changed with atomic operations.
  */
 void interrupt(ushort lvl, ushort sub){
-	int s;
-	while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-		continue; /* Restart if interrupted by handler */
 	if (lvl == 14) {
-		gIID |= sub;
-		if (gIID & gIIE) gPID|= (1<<14);
+		if (__atomic_or_fetch(&gIID,sub,__ATOMIC_SEQ_CST) & gIIE)
+			__atomic_or_fetch(&gPID,1<<14,__ATOMIC_SEQ_CST);
 	} else {
-		gPID |= (1 << lvl) ;
-	}
-	if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-		if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-		CurrentCPURunMode = SHUTDOWN;
+		__atomic_or_fetch(&gPID,1<<lvl,__ATOMIC_SEQ_CST);
 	}
-	checkPK();
+	PostEvent(EVT_PK);
 }
 
 /*
@@ -3275,6 +3623,45 @@ bool IsShadowMemAccess(ulong addr) {
 	return false;
 }
 
+/*
+ * PageMark - Page vpn of page table pt_num has been used, or written.
+ */
+static inline void PageMark(unsigned char pt_num, unsigned char vpn, bool write) {
+	unsigned long long bit = 1ULL << vpn;
+	if (!(gPageBits->used[pt_num] & bit))
+		gPageBits->used[pt_num] |= bit;
+	if (write && !(gPageBits->written[pt_num] & bit))
+		gPageBits->written[pt_num] |= bit;
+}
+
+/*
+ * PageBitsEntry - PGU and WIP from gPageBits for page table entry ptadd,
+ * where they go in the entry.
+ */
+static inline ulong PageBitsEntry(ushort ptadd) {
+	unsigned long long bit = 1ULL << (ptadd & 077);
+	return(((gPageBits->used[ptadd >> 6] & bit) ? ((ulong)0x01<<27) : 0) |
+		((gPageBits->written[ptadd >> 6] & bit) ? ((ulong)0x02<<27) : 0));
+}
+
+static inline void PageBitsClear(ushort ptadd) {
+	unsigned long long bit = 1ULL << (ptadd & 077);
+	gPageBits->used[ptadd >> 6] &= ~bit;
+	gPageBits->written[ptadd >> 6] &= ~bit;
+}
+
+/*
+ * PageBitsSync - Move PGU and WIP from gPageBits into the page tables, so
+ * gPT has the real entries while the cpu is stopped. Cpu thread only, it
+ * would race with PageMark and PT_Write anywhere else.
+ */
+void PageBitsSync(void) {
+	int i;
+	for (i=0;i<4*64;i++)
+		gPT->pt_arr[i] |= PageBitsEntry(i);
+	memset(gPageBits,0,sizeof(*gPageBits));
+}
+
 /*
  * Write to shadow mem/pagetables.
  */
@@ -3282,7 +3669,8 @@ void PT_Write(ushort value, ushort addr, ushort byte_select){
 	ushort ptadd;
 	ulong temp;
 	ptadd = (STS_SEXI) ? (addr & 0x01ff) >>1 : (addr & 0x00ff);
-	temp = gPT->pt_arr[ptadd];
+	temp = gPT->pt_arr[ptadd] | PageBitsEntry(ptadd);
+	PageBitsClear(ptadd);	/* the entry has them now */
 //	if (debug) fprintf(debugfile,"PT_Write: addr=%06o(%d) ptadd=%d temp=%08x byte_select=%d value=%04x SEXI=%d\n",
 //		addr,addr,ptadd,temp,byte_select,value,STS_SEXI);
 	switch(byte_select) {
@@ -3310,6 +3698,10 @@ void PT_Write(ushort value, ushort addr, ushort byte_select){
 	}
 //	if (debug) fprintf(debugfile,"PT_Write: ==> temp=%08x\n",temp);
 	gPT->pt_arr[ptadd]=temp;
+	TlbInvalidate(ptadd >> 6,ptadd & 077);
+	if (wp_vpn & (1ULL << (ptadd & 077)))
+		WatchMap();	/* A watched virtual address may be somewhere else now */
+	bc_break = 1;	/* Mapping may have changed under a running block */
 	if (trace & 0x08) fprintf(tracefile,
 		"#m (i,t,a) #v# (\"%d\",\"Write PageTables\",\"%08o\");\n",
 		(int)instr_counter,addr);
@@ -3325,7 +3717,7 @@ ushort PT_Read(ushort addr){
 	unsigned int temp;	/* This should be 32 bit always */
 	ushort res;
 	ptadd = (STS_SEXI) ? (addr & 0x01ff) >>1 : (addr & 0x00ff);
-	temp = gPT->pt_arr[ptadd];
+	temp = gPT->pt_arr[ptadd] | PageBitsEntry(ptadd);
 	if (debug) fprintf(debugfile,"PT_Read: addr=%06o(%d) ptadd=%d temp=%08x SEXI=%d\n",
 		addr,addr,ptadd,temp,STS_SEXI);
 	if(STS_SEXI)
@@ -3346,8 +3738,10 @@ void PhysMemWrite(ushort value, ulong addr){
 		PT_Write(value,(ushort)addr,2); /* 2 = word write */
 		return;
 	}
-	addr &= (ND_Memsize); /* Mask it to the memory size we have to prevent coredumps :) */
-	p_phy_addr = &VolatileMemory.n_Array[addr];
+	addr &= (ND_Memsize - 1); /* Mask it to the memory size we have to prevent coredumps :) */
+	HEAT(HM_WRITE,addr);
+	if (bc_pagemap[addr >> 10]) BlockCacheWrite(addr);	/* Code in this page is cached */
+	p_phy_addr = &VolatileMemory->n_Array[addr];
 	*p_phy_addr = value;
 }
 
@@ -3360,8 +3754,24 @@ ushort PhysMemRead(ulong addr){
 		res = PT_Read((ushort)addr);
 		return(res); /* PT data */
 	}
-	addr &= (ND_Memsize); /* Mask it to the memory size we have to prevent coredumps :) */
-	return VolatileMemory.n_Array[addr];
+	addr &= (ND_Memsize - 1); /* Mask it to the memory size we have to prevent coredumps :) */
+	HEAT(HM_READ,addr);
+	return VolatileMemory->n_Array[addr];
+}
+
+/*
+ * MemoryAbort - A memory access has faulted and the interrupt is posted.
+ * If that takes the cpu to level 14 now, abort the instruction like the
+ * real cpu does: nothing after the access is done, P is left at the
+ * instruction, and it is run again when the level is returned to. The
+ * handlers leave P and the registers alone until their last access for
+ * this. Does not return then, the cpu loop picks up at its sigsetjmp.
+ * Otherwise the access just fails and the instruction carries on, as
+ * also when not running (loading, the monitor call emulation).
+ */
+static void MemoryAbort(void) {
+	if (cpu_abort_on && STS_IONI && (gPID & gPIE & (1<<14)) && (gPIL < 14))
+		siglongjmp(cpu_abort,1);
 }
 
 /*
@@ -3375,13 +3785,22 @@ void MemoryWrite(ushort value, ushort addr, bool UseAPT, unsigned char byte_sele
 	ushort ppn;
 	unsigned char pt_num;
 	ulong PTe;
+	ulong paddr;
 	ushort* p_phy_addr;
+	ushort *page;
 //	bool error = false;
 
 	/* just debug the virtual address for now. later on we got to get the real address I think */
 	/* this is for now so we can get output of all memory accesses in a program and debug instructions at full speed */
 //	if (trace) AddMemTrace((unsigned int)addr,'W');
 
+	/* Pages in the TLB are known to be plain memory, WIP and PGU already set */
+	if (STS_PONI && !(trace & 0x08) &&
+	    (page = gReg->myreg_TLB->write[STS_PTM && UseAPT][vpn])) {
+		p_phy_addr = &page[addr & 01777];
+		goto write;
+	}
+
 	/* First we check if Shadow Memory is accessible. */
 	if(IsShadowMemAccess((ulong)addr)) { /* Write to PageTables!!! */
 		PT_Write(value,addr,byte_select);
@@ -3414,6 +3833,7 @@ void MemoryWrite(ushort value, ushort addr, bool UseAPT, unsigned char byte_sele
 			if (trace & 0x08) fprintf(tracefile,
 				"#m (i,t,a) #v# (\"%d\",\"Write Fail(WPM)\",\"%08o\");\n",
 				(int)instr_counter,addr);
+			MemoryAbort();
 			return;
 //			error=true;
 		}
@@ -3427,31 +3847,47 @@ void MemoryWrite(ushort value, ushort addr, bool UseAPT, unsigned char byte_sele
 			if (trace & 0x08) fprintf(tracefile,
 				"#m (i,t,a) #v# (\"%d\",\"Write Fail(Ring)\",\"%08o\");\n",
 				(int)instr_counter,addr);
+			MemoryAbort();
 			return;
 //			error=true;
 		}
 //		if(error) return;
 
 		/* Mark that the page was written and used */
-		gPT->pt[pt_num][vpn] |= ((ulong)0x03<<27); /* Set WIP and PGU */
+		PageMark(pt_num,vpn,true); /* Set WIP and PGU */
 
 		/* Get physical page number */
 		ppn = (STS_SEXI) ? PTe & 0x3fff : PTe & 0x01ff;
+		if (ppn >= (ND_Memsize >> 10)) {	/* Past the memory there is, see memsize */
+			interrupt(14,1<<9); /* Memory Out of Range */
+			if (trace & 0x08) fprintf(tracefile,
+				"#m (i,t,a) #v# (\"%d\",\"Write Fail(MOR)\",\"%08o\");\n",
+				(int)instr_counter,addr);
+			MemoryAbort();
+			return;
+		}
+		if ((vpn != 077) || (ring_num != 3))	/* not shadow memory */
+			gReg->myreg_TLB->write[STS_PTM && UseAPT][vpn] = VolatileMemory->n_Pages[ppn];
 
 //		if (debug) fprintf(debugfile,"WriteMemory: OK, PTe=%08x pt_num=%d vpn=%d ppn=%04x\n",PTe,pt_num,vpn,ppn);
 //		if (debug) fprintf(debugfile,"WriteMemory: OK, gPT->pt[pt_num][vpn]=%08x\n",gPT->pt[pt_num][vpn]);
 
-		p_phy_addr = &VolatileMemory.n_Pages[ppn][addr & (((ushort)1<<10) - 1)];
+		p_phy_addr = &VolatileMemory->n_Pages[ppn][addr & (((ushort)1<<10) - 1)];
 		if (trace& 0x08) fprintf(tracefile,
 			"#m (i,t,a) #v# (\"%d\",\"Write (PT)\",\"%08o\");\n",
 			(int)instr_counter,addr);
 	} else {
-		p_phy_addr = &VolatileMemory.n_Array[addr];	/* Only 16 address bits in POF mode */
+		p_phy_addr = &VolatileMemory->n_Array[addr];	/* Only 16 address bits in POF mode */
 		if (trace & 0x08) fprintf(tracefile,
 			"#m (i,t,a) #v# (\"%d\",\"Write ()\",\"%08o\");\n",
 			(int)instr_counter,addr);
 	}
 
+write:
+	paddr = p_phy_addr - VolatileMemory->n_Array;
+	HEAT(HM_WRITE,paddr);
+	if (bc_pagemap[paddr >> 10]) BlockCacheWrite(paddr);	/* Code in this page is cached */
+
 	// :NOTE: ND memory is big endian but NDemulator is little endian!
 	switch(byte_select) {
 	case 0:		/* Even, which means MSB byte, or bits 15-8 */
@@ -3478,6 +3914,7 @@ ushort MemoryRead(ushort addr, bool UseAPT) {
 	unsigned char vpn = addr>>10;
 	ushort ppn;
 	unsigned char pt_num;
+	ushort *page;
 //	bool error = false;
 
 
@@ -3485,6 +3922,17 @@ ushort MemoryRead(ushort addr, bool UseAPT) {
 	/* this is for now so we can get output of all memory accesses in a program and debug instructions at full speed */
 //	if (trace) AddMemTrace((unsigned int)addr,'R');
 
+	/*
+	 * Most accesses with paging on are to a page looked up before. The
+	 * TLB has those, permission and ring checked and PGU set, and never
+	 * has the shadow memory page.
+	 */
+	if (STS_PONI && !(trace & 0x08) &&
+	    (page = gReg->myreg_TLB->read[STS_PTM && UseAPT][vpn])) {
+		HEAT(HM_READ,(page - VolatileMemory->n_Array));
+		return(page[addr & 01777]);
+	}
+
 	/* First we check if Shadow Memory is accessible. */
 	if(IsShadowMemAccess((ulong)addr)) { /* Read from PageTables!!! */
 		res = PT_Read(addr);
@@ -3513,7 +3961,8 @@ ushort MemoryRead(ushort addr, bool UseAPT) {
 			if (trace & 0x08) fprintf(tracefile,
 				"#m (i,t,a) #v# (\"%d\",\"Read Fail(RPM)\",\"%08o\");\n",
 				(int)instr_counter,addr);
-			return(0); /* TODO:: We should rethink MemoryRead to handle errors more gracefully. */
+			MemoryAbort();
+			return(0); /* Not aborted, the instruction goes on with 0 */
 //			error=true;
 		}
 
@@ -3526,17 +3975,28 @@ ushort MemoryRead(ushort addr, bool UseAPT) {
 			if (trace & 0x08) fprintf(tracefile,
 				"#m (i,t,a) #v# (\"%d\",\"Read Fail(Ring)\",\"%08o\");\n",
 				(int)instr_counter,addr);
-			return(0); /* TODO:: We should rethink MemoryRead to handle errors more gracefully. */
+			MemoryAbort();
+			return(0); /* Not aborted, the instruction goes on with 0 */
 //			error=true;
 		}
 
 //		if (error) return;
 
 		/* Mark that the page was used */
-		gPT->pt[pt_num][vpn] |= ((ulong)0x01<<27); /* Set PGU */
+		PageMark(pt_num,vpn,false); /* Set PGU */
 
 		/* Get physical page number */
 		ppn = (STS_SEXI) ? PTe & 0x3fff : PTe & 0x01ff;
+		if (ppn >= (ND_Memsize >> 10)) {	/* Past the memory there is, see memsize */
+			interrupt(14,1<<9); /* Memory Out of Range */
+			if (trace & 0x08) fprintf(tracefile,
+				"#m (i,t,a) #v# (\"%d\",\"Read Fail(MOR)\",\"%08o\");\n",
+				(int)instr_counter,addr);
+			MemoryAbort();
+			return(0);
+		}
+		if ((vpn != 077) || (ring_num != 3))	/* not shadow memory */
+			gReg->myreg_TLB->read[STS_PTM && UseAPT][vpn] = VolatileMemory->n_Pages[ppn];
 
 //		if (debug) fprintf(debugfile,"ReadMemory: OK, PTe=%08x pt_num=%d vpn=%d ppn=%04x\n",PTe,pt_num,vpn,ppn);
 //		if (debug) fprintf(debugfile,"ReadMemory: OK, gPT->pt[pt_num][vpn]=%08x\n",gPT->pt[pt_num][vpn]);
@@ -3544,12 +4004,14 @@ ushort MemoryRead(ushort addr, bool UseAPT) {
 		if (trace & 0x08) fprintf(tracefile,
 			"#m (i,t,a) #v# (\"%d\",\"Read (PT)\",\"%08o\");\n",
 			(int)instr_counter,addr);
-		return VolatileMemory.n_Pages[ppn][addr & (((ushort)1<<10) - 1)];
+		HEAT(HM_READ,(ulong)ppn << 10);
+		return VolatileMemory->n_Pages[ppn][addr & (((ushort)1<<10) - 1)];
 	} else {
 		if (trace & 0x08) fprintf(tracefile,
 			"#m (i,t,a) #v# (\"%d\",\"Read ()\",\"%08o\");\n",
 			(int)instr_counter,addr);
-		return VolatileMemory.n_Array[addr];	/* Only 16 address bits in POF mode */
+		HEAT(HM_READ,addr);
+		return VolatileMemory->n_Array[addr];	/* Only 16 address bits in POF mode */
 	}
 }
 
@@ -3561,14 +4023,24 @@ ushort MemoryFetch(ushort addr, bool UseAPT) {
 	unsigned char vpn = addr>>10;
 	ushort ppn;
 	unsigned char pt_num;
+	ushort *page;
 //	bool error = false;
 
 	/* just debug the virtual address for now. later on we got to get the real address I think */
 	/* this is for now so we can get output of all memory accesses in a program and debug instructions at full speed */
 //	if (trace) AddMemTrace((unsigned int)addr,'F');
 
+	/* See MemoryRead */
+	if (STS_PONI && !(trace & 0x08) &&
+	    (page = gReg->myreg_TLB->fetch[STS_PTM && UseAPT][vpn])) {
+		gReg->myreg_PFA = (page - VolatileMemory->n_Array) + (addr & 01777);
+		HEAT(HM_FETCH,gReg->myreg_PFA);
+		return(page[addr & 01777]);
+	}
+
 	/* First we check if Shadow Memory is accessible. */
 	if(IsShadowMemAccess((ulong)addr)) { /* Read from PageTables!!! */
+		gReg->myreg_PFA = ~0UL;
 		res = PT_Read(addr);
 		return(res); /* PT data */
 	}
@@ -3592,7 +4064,9 @@ ushort MemoryFetch(ushort addr, bool UseAPT) {
 			if (trace & 0x08) fprintf(tracefile,
 				"#m (i,t,a) #v# (\"%d\",\"Fetch Fail(FPM)\",\"%08o\");\n",
 				(int)instr_counter,addr);
-			return(0); /* TODO:: We should rethink MemoryFetch to handle errors more gracefully. */
+			gReg->myreg_PFA = ~0UL;
+			MemoryAbort();
+			return(0); /* Not aborted, a STZ gets run */
 //			error = true;
 		}
 
@@ -3604,17 +4078,30 @@ ushort MemoryFetch(ushort addr, bool UseAPT) {
 			if (trace & 0x08) fprintf(tracefile,
 				"#m (i,t,a) #v# (\"%d\",\"Fetch Fail(Ring)\",\"%08o\");\n",
 				(int)instr_counter,addr);
-			return(0); /* TODO:: We should rethink MemoryFetch to handle errors more gracefully. */
+			gReg->myreg_PFA = ~0UL;
+			MemoryAbort();
+			return(0); /* Not aborted, a STZ gets run */
 //			error = true;
 		}
 
 //		if (error) return;
 
 		/* Mark that the page was used */
-		gPT->pt[pt_num][vpn] |= ((ulong)0x01<<27); /* Set PGU */
+		PageMark(pt_num,vpn,false); /* Set PGU */
 
 		/* Get physical page number */
 		ppn = (STS_SEXI) ? PTe & 0x3fff : PTe & 0x01ff;
+		if (ppn >= (ND_Memsize >> 10)) {	/* Past the memory there is, see memsize */
+			interrupt(14,1<<9); /* Memory Out of Range */
+			if (trace & 0x08) fprintf(tracefile,
+				"#m (i,t,a) #v# (\"%d\",\"Fetch Fail(MOR)\",\"%08o\");\n",
+				(int)instr_counter,addr);
+			gReg->myreg_PFA = ~0UL;
+			MemoryAbort();
+			return(0);
+		}
+		if ((vpn != 077) || (ring_num != 3))	/* not shadow memory */
+			gReg->myreg_TLB->fetch[STS_PTM && UseAPT][vpn] = VolatileMemory->n_Pages[ppn];
 
 //		if (debug) fprintf(debugfile,"FetchMemory: OK, PTe=%08x pt_num=%d vpn=%d ppn=%04x\n",PTe,pt_num,vpn,ppn);
 //		if (debug) fprintf(debugfile,"FetchMemory: OK, gPT->pt[pt_num][vpn]=%08x\n",gPT->pt[pt_num][vpn]);
@@ -3622,39 +4109,291 @@ ushort MemoryFetch(ushort addr, bool UseAPT) {
 		if (trace & 0x08) fprintf(tracefile,
 			"#m (i,t,a) #v# (\"%d\",\"Fetch (PT)\",\"%08o\");\n",
 			(int)instr_counter,addr);
-		return VolatileMemory.n_Pages[ppn][addr & (((ushort)1<<10) - 1)];
+		gReg->myreg_PFA = ((ulong)ppn << 10) | (addr & (((ushort)1<<10) - 1));
+		HEAT(HM_FETCH,gReg->myreg_PFA);
+		return VolatileMemory->n_Pages[ppn][addr & (((ushort)1<<10) - 1)];
 	} else {
 		if (trace & 0x08) fprintf(tracefile,
 			"#m (i,t,a) #v# (\"%d\",\"Fetch ()\",\"%08o\");\n",
 			(int)instr_counter,addr);
-		return VolatileMemory.n_Array[addr];	/* Only 16 address bits in POF mode */
+		gReg->myreg_PFA = addr;
+		HEAT(HM_FETCH,addr);
+		return VolatileMemory->n_Array[addr];	/* Only 16 address bits in POF mode */
 	}
 }
 
-void cpurun(){
-	int s;
-	ushort operand, p_now;
-	char disasm_str[256];
-//	debug=0; /* PT DEBUGGING: remove once finished */
-	prefetch(); /* works because gPC should already be setup when cpurun is called */
+/*
+ * Translate a whole page for callers doing several plain accesses to it.
+ * Returns the host address of the physical page that virtual page vpn
+ * maps to, and marks it used (and written) like MemoryRead/MemoryWrite
+ * would. Returns NULL if a word access could do anything else: the top
+ * page (shadow memory), a page fault or protection violation, a page past
+ * the memory there is, or a write to a page with cached code. Nothing is
+ * signalled then, the caller has to redo the access through
+ * MemoryRead/MemoryWrite.
+ */
+ushort *MemoryPage(ushort vpn, bool UseAPT, bool write) {
+	ushort pcr = gReg->reg_PCR[CurrLEVEL];
+	unsigned char ring_num = pcr & 0x03;
+	unsigned char pt_num;
+	ulong PTe;
+	ushort ppn;
+
+	if (vpn >= 077)
+		return(NULL);
+	if (STS_PONI) {
+		if((STS_PTM) && UseAPT)
+			pt_num = (pcr>>7) & 0x03;	/* APT */
+		else
+			pt_num = (pcr>>9) & 0x03;	/* PT */
+
+		PTe = gPT->pt[pt_num][vpn];
+		if (!(PTe & ((ulong)1 << ((write) ? 31 : 30))))	/* WPM / RPM */
+			return(NULL);
+		if(((PTe>>24) & 0x03) > ring_num)
+			return(NULL);
+		ppn = (STS_SEXI) ? PTe & 0x3fff : PTe & 0x01ff;
+		if ((ppn >= (ND_Memsize >> 10)) || (write && bc_pagemap[ppn]))	/* no memory there, or cached code */
+			return(NULL);
+		PageMark(pt_num,vpn,write); /* Set WIP and PGU */
+		return(VolatileMemory->n_Pages[ppn]);
+	}
+	if (write && bc_pagemap[vpn])
+		return(NULL);
+	return(VolatileMemory->n_Pages[vpn]);
+}
+
+#ifdef THREADED_DISPATCH
+/*
+ * ThreadedRun - direct threaded dispatch loop (gcc labels as values)
+ * Runs instructions starting with the one in IR until limit instructions
+ * are done or something outside the instruction stream needs attention.
+ * With the block cache on it also stops as soon as P is somewhere
+ * BlockRun can take, so it only runs what the block cache leaves to the
+ * interpreter (the top page and shadow memory).
+ * The common load/store/jump/skip handlers are expanded in place, all
+ * others (ROPs already have one handler per encoding) are called through
+ * INSTR_FUNC. Every handler ends with its own
+ * fetch and indirect jump, so prefetch is part of the dispatch.
+ * Called with limit 0 it (re)builds its dispatch table from the handlers.
+ * With COMPACT_DISPATCH the table has one label per handler number instead
+ * of one per instruction word.
+ * Returns number of instructions executed, with PFB holding the next one.
+ */
+int ThreadedRun(int limit) {
+#ifdef COMPACT_DISPATCH
+#define TD_SLOTS	INSTR_HANDLERS_MAX
+#define TD_SLOT(instr)	instr_index[instr]
+#define TD_FUNC(slot)	instr_handlers[slot]
+#else
+#define TD_SLOTS	65536
+#define TD_SLOT(instr)	(instr)
+#define TD_FUNC(slot)	instr_funcs[slot]
+#endif
+	static void *td_table[TD_SLOTS];
+	void (*func)(ushort);
+	bool UseAPT;
+	ushort operand, eff_addr, temp;
+	int i, m, n;
+
+#define TD_DISPATCH()								\
+	do {									\
+		prefetch();							\
+		if ((++n >= limit) || (CurrentCPURunMode != RUN) || trace ||	\
+		    cpu_events || (STS_IONI && (gPK != gPIL)) ||		\
+		    (BLOCK_CACHE && (gReg->myreg_PFA != ~0UL) && (gPC < 0176000)))	\
+			return(n);						\
+		operand = gReg->myreg_PFB;					\
+		goto *td_table[TD_SLOT(operand)];				\
+	} while (0)
+
+#define TD_JUMP(cond)								\
+	do {									\
+		if (cond) {							\
+			temp = (ushort)(sshort)(char)(operand&0x00ff);		\
+			gPC = do_add(gPC,temp,0);				\
+		} else								\
+			gPC++;							\
+		TD_DISPATCH();							\
+	} while (0)
+
+/* Memory reference instructions get one body per addressing mode */
+#define TD_MEMREF_MODE(name,m,...)						\
+	td_##name##_##m:							\
+		eff_addr = EA_##m(operand,UseAPT);				\
+		__VA_ARGS__;							\
+		gPC++;								\
+		TD_DISPATCH()
+#define TD_MEMREF(name,...)							\
+	TD_MEMREF_MODE(name,0,__VA_ARGS__); TD_MEMREF_MODE(name,1,__VA_ARGS__);	\
+	TD_MEMREF_MODE(name,2,__VA_ARGS__); TD_MEMREF_MODE(name,3,__VA_ARGS__);	\
+	TD_MEMREF_MODE(name,4,__VA_ARGS__); TD_MEMREF_MODE(name,5,__VA_ARGS__);	\
+	TD_MEMREF_MODE(name,6,__VA_ARGS__); TD_MEMREF_MODE(name,7,__VA_ARGS__)
+#define TD_LABELS(name)								\
+	&&td_##name##_0, &&td_##name##_1, &&td_##name##_2, &&td_##name##_3,	\
+	&&td_##name##_4, &&td_##name##_5, &&td_##name##_6, &&td_##name##_7
+
+	if (!limit) {
+		void *td_stz[8] = { TD_LABELS(stz) }, *td_sta[8] = { TD_LABELS(sta) };
+		void *td_stt[8] = { TD_LABELS(stt) }, *td_stx[8] = { TD_LABELS(stx) };
+		void *td_lda[8] = { TD_LABELS(lda) }, *td_ldt[8] = { TD_LABELS(ldt) };
+		void *td_ldx[8] = { TD_LABELS(ldx) };
+
+		for (i = 0; i < TD_SLOTS; i++) {
+			func = TD_FUNC(i);
+			td_table[i] = &&td_call;
+			for (m = 0; m < 8; m++) {
+				if (func == ndfunc_stz_mode[m]) td_table[i] = td_stz[m];
+				else if (func == ndfunc_sta_mode[m]) td_table[i] = td_sta[m];
+				else if (func == ndfunc_stt_mode[m]) td_table[i] = td_stt[m];
+				else if (func == ndfunc_stx_mode[m]) td_table[i] = td_stx[m];
+				else if (func == ndfunc_lda_mode[m]) td_table[i] = td_lda[m];
+				else if (func == ndfunc_ldt_mode[m]) td_table[i] = td_ldt[m];
+				else if (func == ndfunc_ldx_mode[m]) td_table[i] = td_ldx[m];
+			}
+			if (func == &ndfunc_skp) td_table[i] = &&td_skp;
+			else if (func == &ndfunc_jap) td_table[i] = &&td_jap;
+			else if (func == &ndfunc_jan) td_table[i] = &&td_jan;
+			else if (func == &ndfunc_jaz) td_table[i] = &&td_jaz;
+			else if (func == &ndfunc_jaf) td_table[i] = &&td_jaf;
+			else if (func == &ndfunc_jpc) td_table[i] = &&td_jpc;
+			else if (func == &ndfunc_jnc) td_table[i] = &&td_jnc;
+			else if (func == &ndfunc_jxz) td_table[i] = &&td_jxz;
+			else if (func == &ndfunc_jxn) td_table[i] = &&td_jxn;
+		}
+		return(0);
+	}
+
+	n = 0;
+	operand = gReg->myreg_IR;
+	goto *td_table[TD_SLOT(operand)];
+
+td_call:
+	INSTR_FUNC(operand)(operand);
+	TD_DISPATCH();
+	TD_MEMREF(stz, MemoryWrite(0,eff_addr,UseAPT,2));
+	TD_MEMREF(sta, MemoryWrite(gA,eff_addr,UseAPT,2));
+	TD_MEMREF(stt, MemoryWrite(gT,eff_addr,UseAPT,2));
+	TD_MEMREF(stx, MemoryWrite(gX,eff_addr,UseAPT,2));
+	TD_MEMREF(lda, gA = MemoryRead(eff_addr,UseAPT));
+	TD_MEMREF(ldt, gT = MemoryRead(eff_addr,UseAPT));
+	TD_MEMREF(ldx, gX = MemoryRead(eff_addr,UseAPT));
+td_skp:
+	gPC++;
+	if (IsSkip(operand))
+		gPC++;
+	TD_DISPATCH();
+td_jap:
+	TD_JUMP(!((1<<15) & gA));
+td_jan:
+	TD_JUMP((1<<15) & gA);
+td_jaz:
+	TD_JUMP(gA == 0);
+td_jaf:
+	TD_JUMP(gA != 0);
+td_jpc:
+	gX++;
+	TD_JUMP(!((1<<15) & gX));
+td_jnc:
+	gX++;
+	TD_JUMP((1<<15) & gX);
+td_jxz:
+	TD_JUMP(gX == 0);
+td_jxn:
+	TD_JUMP((1<<15) & gX);
+
+#undef TD_LABELS
+#undef TD_MEMREF
+#undef TD_MEMREF_MODE
+#undef TD_JUMP
+#undef TD_DISPATCH
+}
+#endif
+
+/*
+ * Change to the runlevel the interrupt system asks for.
+ */
+static void ChangeLevel(void) {
+	gPVL = gPIL; /* Save current runlevel */
+	setPIL(gPK); /* Change to new runlevel */
+	prefetch(); /* Ok, since we are changing runlevel, we chuck old prefetched instruction and fetch a new one. */
+}
+
+/*
+ * AbortLevel - Back in a cpu loop after MemoryAbort. Go to level 14,
+ * saving P of the aborted instruction, and carry on from there.
+ */
+static void AbortLevel(void) {
+	DoEvents();
+	ChangeLevel();
 	gReg->myreg_IR = gReg->myreg_PFB;
-	while ((CurrentCPURunMode != STOP) && (CurrentCPURunMode != SHUTDOWN)) {
+}
+
+/*
+ * cpurun_fast - Run with no tracing, disassembly or single stepping.
+ * There is nothing here but the instructions and the level change, the
+ * checks for trace and DISASM are done once per block. Returns as soon
+ * as any of them is turned on, so cpurun can switch to cpurun_traced.
+ */
+static void cpurun_fast(void) {
+	int n;
+	if (sigsetjmp(cpu_abort,0))
+		AbortLevel();
+	cpu_abort_on = true;
+	while ((CurrentCPURunMode == RUN) && !trace && !DISASM) {
+		if (BLOCK_CACHE && (gReg->myreg_PFA != ~0UL) && (n = BlockRun(gReg->myreg_PFA))) {
+			instr_counter += n;
+		} else {
+#ifdef THREADED_DISPATCH
+			/* Gives control back to the block cache when P is somewhere it can run */
+			instr_counter += ThreadedRun(INT_MAX);
+#else
+			instr_counter++;
+			do_op(gReg->myreg_IR);
+#endif
+		}
+		if (cpu_events)
+			DoEvents();
+		if (STS_IONI && (gPK != gPIL)) /* Time to change runlevel */
+			ChangeLevel();
+		gReg->myreg_IR = gReg->myreg_PFB; /* prefetch of next instruction should have been done while executing current one. */
+	}
+	cpu_abort_on = false;
+}
+
+/*
+ * cpurun_traced - Run one instruction at a time with all the hooks for
+ * SEMIRUN, tracing and disassembly. Returns when none of them is needed.
+ */
+static void cpurun_traced(void) {
+	ushort operand, p_now;
+	if (sigsetjmp(cpu_abort,0)) {
+		if (trace) trace_step(1,"ABORT P=%06o",(int)gPC);
+		if (trace) trace_flush();
+		AbortLevel();
+	}
+	cpu_abort_on = true;
+	while ((CurrentCPURunMode == SEMIRUN) ||
+	       ((CurrentCPURunMode == RUN) && (trace || DISASM))) {
 		if (CurrentCPURunMode == SEMIRUN) { /* Here we should handle single step, breakpoints etc */
 			if(gReg->has_breakpoint)
 				if (gReg->breakpoint == gPC) {		/* TODO:: Check if we should execute the instruction at breakpoint address or not */
 					CurrentCPURunMode = STOP;
-					return;
+					break;
 				}
 			if (gReg->has_instr_cntr)
 				if(gReg->instructioncounter > 0)
 					gReg->instructioncounter--;
 				else {
 					CurrentCPURunMode = STOP;
-					return;
+					break;
 				}
 		}
 		instr_counter++;
-		if (trace) trace_pre(1,"S",gReg->reg[CurrLEVEL][0]);
+		if (trace) {
+			SyncSTS();
+			trace_pre(1,"S",gReg->myreg_CUR[0]);
+		}
 		operand=gReg->myreg_IR;
 //		operand=MemoryFetch(gPC,true);
 		p_now=gPC;
@@ -3662,21 +4401,34 @@ void cpurun(){
 		if (DISASM) disasm_instr(gPC,operand);
 		do_op(operand);
 		if (trace & 0x16) trace_regs();
-		if(STS_IONI && (gPK != gPIL)) { /* Time to change runlevel */
-			while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-				continue; /* Restart if interrupted by handler */
-			gPVL = gPIL; /* Save current runlevel */
-			setPIL(gPK); /* Change to new runlevel */
-			if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-				if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-				CurrentCPURunMode = SHUTDOWN;
-			}
-			prefetch(); /* Ok, since we are changing runlevel, we chuck old prefetched instruction and fetch a new one. */
+		if (cpu_events)
+			DoEvents();
+		if(STS_IONI && (gPK != gPIL)) /* Time to change runlevel */
+			ChangeLevel();
+		if (trace) {
+			SyncSTS();
+			trace_post(1,"S",gReg->myreg_CUR[0]);
 		}
-		if (trace) trace_post(1,"S",gReg->reg[CurrLEVEL][0]);
 		if (trace) trace_flush();
 		gReg->myreg_IR = gReg->myreg_PFB; /* prefetch of next instruction should have been done while executing current one. */
 	}
+	cpu_abort_on = false;
+}
+
+/*
+ * cpurun - Run until stopped, in whichever of the two loops fits what is
+ * turned on right now. trace can be changed from the panel while running.
+ */
+void cpurun(){
+//	debug=0; /* PT DEBUGGING: remove once finished */
+	prefetch(); /* works because gPC should already be setup when cpurun is called */
+	gReg->myreg_IR = gReg->myreg_PFB;
+	while ((CurrentCPURunMode != STOP) && (CurrentCPURunMode != SHUTDOWN)) {
+		if ((CurrentCPURunMode == RUN) && !trace && !DISASM)
+			cpurun_fast();
+		else
+			cpurun_traced();
+	}
 }
 
 void cpu_thread(){
@@ -3690,6 +4442,8 @@ void cpu_thread(){
 
 	while (CurrentCPURunMode != SHUTDOWN) {
 		if(CurrentCPURunMode != STOP) cpurun();
+		SyncSTS();	/* let anyone looking at the registers see the real flags */
+		PageBitsSync();	/* and at the page tables the real PGU and WIP */
 
 		/* signal that we are now stopped and the routine waiting on us can continue */
 		if(CurrentCPURunMode != SHUTDOWN) {
@@ -3801,95 +4555,350 @@ void PrintMemTrace(){
 	}
 }
 
+/*
+ * Compact instruction dispatch.
+ * Every instruction word maps to a 16 bit handler number in instr_index[],
+ * and the handler number to a function in instr_handlers[]. That is 128 KB
+ * instead of the 512 KB of pointers in instr_funcs, so dispatch leaves more
+ * of the cache to guest memory. Both tables are built by the compiler from
+ * the lists below, with later ranges in instr_index_init overriding earlier
+ * ones the same way the Instruction_Add calls used to, so Setup_Instructions
+ * only has to copy the table and patch in the cpu type differences.
+ */
+
+/* Handlers for one instruction word or range, INSTR_SINGLE(name,function) */
+#define INSTR_SINGLES(X)							\
+	X(ILLEGAL,illegal_instr)	X(UNIMPL,unimplemented_instr)		\
+	X(JAP,ndfunc_jap)	X(JAN,ndfunc_jan)	X(JAZ,ndfunc_jaz)	\
+	X(JAF,ndfunc_jaf)	X(JPC,ndfunc_jpc)	X(JNC,ndfunc_jnc)	\
+	X(JXZ,ndfunc_jxz)	X(JXN,ndfunc_jxn)	X(SKP,ndfunc_skp)	\
+	X(BFILL,ndfunc_bfill)	X(MOVB,DoMOVB)		X(MOVBF,DoMOVBF)	\
+	X(TSET,ndfunc_tset)	X(RDUS,ndfunc_rdus)	X(MOVEW,ndfunc_movew)	\
+	X(VERSN,ndfunc_versn)	X(INIT,ndfunc_init)	X(ENTR,ndfunc_entr)	\
+	X(LEAVE,ndfunc_leave)	X(ELEAV,ndfunc_eleav)	X(EXR,DoEXR)		\
+	X(SETPT,ndfunc_setpt)	X(CLEPT,ndfunc_clept)	X(RMPY,rmpy)		\
+	X(RDIV,rdiv)		X(LBYT,ndfunc_lbyt)	X(SBYT,ndfunc_sbyt)	\
+	X(GECO,ndfunc_geco)	X(MIX3,ndfunc_mix3)	X(LDATX,ndfunc_ldatx)	\
+	X(LDXTX,ndfunc_ldxtx)	X(LDDTX,ndfunc_lddtx)	X(LDBTX,ndfunc_ldbtx)	\
+	X(STATX,ndfunc_statx)	X(STZTX,ndfunc_stztx)	X(STDTX,ndfunc_stdtx)	\
+	X(IDENT,ndfunc_ident)	X(TRA,DoTRA)		X(TRR,DoTRR)		\
+	X(MCL,DoMCL)		X(MST,DoMST)		X(OPCOM,ndfunc_opcom)	\
+	X(IOF,ndfunc_iof)	X(ION,ndfunc_ion)	X(POF,ndfunc_pof)	\
+	X(PIOF,ndfunc_piof)	X(SEX,ndfunc_sex)	X(REX,ndfunc_rex)	\
+	X(PON,ndfunc_pon)	X(PION,ndfunc_pion)	X(IOXT,ndfunc_ioxt)	\
+	X(EXAM,ndfunc_exam)	X(DEPO,ndfunc_depo)	X(WAIT,DoWAIT)		\
+	X(NLZ,ndfunc_nlz)	X(DNZ,ndfunc_dnz)	X(SRB,ndfunc_srb)	\
+	X(LRB,ndfunc_lrb)	X(MON,ndfunc_mon)	X(IRW,ndfunc_irw)	\
+	X(IRR,ndfunc_irr)	X(SHIFTS,ndfunc_shifts)	X(IOT,ndfunc_iot)	\
+	X(IOX,ndfunc_iox)	X(SAB,ndfunc_sab)	X(SAA,ndfunc_saa)	\
+	X(SAT,ndfunc_sat)	X(SAX,ndfunc_sax)	X(AAB,ndfunc_aab)	\
+	X(AAA,ndfunc_aaa)	X(AAT,ndfunc_aat)	X(AAX,ndfunc_aax)	\
+	X(BOPS,do_bops)
+
+/* Memory reference handlers from MEMREF_HANDLERS, 8 numbers each */
+#define INSTR_MEMREFS(X)							\
+	X(STZ,ndfunc_stz)	X(STA,ndfunc_sta)	X(STT,ndfunc_stt)	\
+	X(STX,ndfunc_stx)	X(STD,ndfunc_std)	X(LDD,ndfunc_ldd)	\
+	X(STF,ndfunc_stf)	X(LDF,ndfunc_ldf)	X(MIN,ndfunc_min)	\
+	X(LDA,ndfunc_lda)	X(LDT,ndfunc_ldt)	X(LDX,ndfunc_ldx)	\
+	X(ADD,ndfunc_add)	X(SUB,ndfunc_sub)	X(AND,ndfunc_and)	\
+	X(ORA,ndfunc_ora)	X(FAD,ndfunc_fad)	X(FSB,ndfunc_fsb)	\
+	X(FMU,ndfunc_fmu)	X(FDV,ndfunc_fdv)	X(MPY,mpy)		\
+	X(JMP,ndfunc_jmp)	X(JPL,ndfunc_jpl)
+
+#define H_SINGLE(n,f)	H_##n,
+#define H_MEMREF(n,f)	H_##n, H_##n##_7 = H_##n + 7,
+enum {
+	INSTR_SINGLES(H_SINGLE)
+	INSTR_MEMREFS(H_MEMREF)
+	H_ROP,				/* 2048 ROP handlers, one per encoding */
+	H_COUNT = H_ROP + 2048
+};
+
+#define F_SINGLE(n,f)	[H_##n] = f,
+#define F_MEMREF(n,f)	[H_##n] = f##_0, f##_1, f##_2, f##_3, f##_4, f##_5, f##_6, f##_7,
+
+void (*instr_handlers[INSTR_HANDLERS_MAX])(ushort) = {
+	INSTR_SINGLES(F_SINGLE)
+	INSTR_MEMREFS(F_MEMREF)
+	[H_ROP] = ROP_NAME512(0), ROP_NAME512(1), ROP_NAME512(2), ROP_NAME512(3)
+};
+int instr_nhandlers = H_COUNT;
+
+/* instr_handlers with the privileged ones replaced by priv_instr, for rings 0 and 1 */
+void (*instr_handlers_user[INSTR_HANDLERS_MAX])(ushort);
+
+/* Handlers only allowed in rings 2 and 3 */
+static void (*const instr_privileged[])(ushort) = {
+	DoTRA, DoTRR, DoMCL, DoMST, DoWAIT, ndfunc_srb, ndfunc_lrb,
+	ndfunc_irw, ndfunc_irr, ndfunc_opcom, ndfunc_iof, ndfunc_ion,
+	ndfunc_pof, ndfunc_piof, ndfunc_sex, ndfunc_rex, ndfunc_pon,
+	ndfunc_pion, ndfunc_iox, ndfunc_ioxt, ndfunc_iot, ndfunc_ident,
+	ndfunc_exam, ndfunc_depo, ndfunc_setpt, ndfunc_clept,
+	ndfunc_ldatx, ndfunc_ldxtx, ndfunc_lddtx, ndfunc_ldbtx,
+	ndfunc_statx, ndfunc_stztx, ndfunc_stdtx
+};
+
+/* gcc range designators, memory reference ranges split by addressing mode */
+#define IX(start,stop,n)	[(start) ... (stop)] = H_##n,
+#define IX_MODES(start,h)							\
+	[(start)        ... (start)+00377] = (h),				\
+	[(start)+00400 ... (start)+00777] = (h)+1,				\
+	[(start)+01000 ... (start)+01377] = (h)+2,				\
+	[(start)+01400 ... (start)+01777] = (h)+3,				\
+	[(start)+02000 ... (start)+02377] = (h)+4,				\
+	[(start)+02400 ... (start)+02777] = (h)+5,				\
+	[(start)+03000 ... (start)+03377] = (h)+6,				\
+	[(start)+03400 ... (start)+03777] = (h)+7,
+#define IX_MEMREF(start,n)	IX_MODES(start,H_##n)
+#define IX_MODES16K(start,h)							\
+	IX_MODES(start,h) IX_MODES((start)+004000,h)				\
+	IX_MODES((start)+010000,h) IX_MODES((start)+014000,h)			\
+	IX_MODES((start)+020000,h) IX_MODES((start)+024000,h)			\
+	IX_MODES((start)+030000,h) IX_MODES((start)+034000,h)
+#define IX_SEQ8(h)	(h), (h)+1, (h)+2, (h)+3, (h)+4, (h)+5, (h)+6, (h)+7
+#define IX_SEQ64(h)								\
+	IX_SEQ8(h), IX_SEQ8((h)+010), IX_SEQ8((h)+020), IX_SEQ8((h)+030),	\
+	IX_SEQ8((h)+040), IX_SEQ8((h)+050), IX_SEQ8((h)+060), IX_SEQ8((h)+070)
+#define IX_SEQ512(h)								\
+	IX_SEQ64(h), IX_SEQ64((h)+0100), IX_SEQ64((h)+0200), IX_SEQ64((h)+0300),	\
+	IX_SEQ64((h)+0400), IX_SEQ64((h)+0500), IX_SEQ64((h)+0600), IX_SEQ64((h)+0700)
+
+/*
+ * Instruction layout for a plain ND100, Setup_Instructions patches in
+ * what differs for the other cpu types.
+ */
+static const ushort instr_index_init[65536] = {
+	/* Anything not set below is handled as STZ, as it always has been */
+	IX_MODES16K(0000000,H_STZ) IX_MODES16K(0040000,H_STZ)
+	IX_MODES16K(0100000,H_STZ) IX_MODES16K(0140000,H_STZ)
+
+	IX_MEMREF(0000000,STZ)		/* STZ  */
+	IX_MEMREF(0004000,STA)		/* STA  */
+	IX_MEMREF(0010000,STT)		/* STT  */
+	IX_MEMREF(0014000,STX)		/* STX  */
+	IX_MEMREF(0020000,STD)		/* STD  */
+	IX_MEMREF(0024000,LDD)		/* LDD  */
+	IX_MEMREF(0030000,STF)		/* STF  */
+	IX_MEMREF(0034000,LDF)		/* LDF  */
+	IX_MEMREF(0040000,MIN)		/* MIN  */
+	IX_MEMREF(0044000,LDA)		/* LDA  */
+	IX_MEMREF(0050000,LDT)		/* LDT  */
+	IX_MEMREF(0054000,LDX)		/* LDX  */
+	IX_MEMREF(0060000,ADD)		/* ADD  */
+	IX_MEMREF(0064000,SUB)		/* SUB  */
+	IX_MEMREF(0070000,AND)		/* AND  */
+	IX_MEMREF(0074000,ORA)		/* ORA  */
+	IX_MEMREF(0100000,FAD)		/* FAD  */
+	IX_MEMREF(0104000,FSB)		/* FSB  */
+	IX_MEMREF(0110000,FMU)		/* FMU  */
+	IX_MEMREF(0114000,FDV)		/* FDV  */
+	IX_MEMREF(0120000,MPY)		/* MPY  */
+	IX_MEMREF(0124000,JMP)		/* JMP  */
+/* CJPs - Conditional jumps */
+	IX(0130000,0130377,JAP)		/* JAP */
+	IX(0130400,0130777,JAN)		/* JAN */
+	IX(0131000,0131377,JAZ)		/* JAZ */
+	IX(0131400,0131777,JAF)		/* JAF */
+	IX(0132000,0132377,JPC)		/* JPC */
+	IX(0132400,0132777,JNC)		/* JNC */
+	IX(0133000,0133377,JXZ)		/* JXZ */
+	IX(0133400,0133777,JXN)		/* JXN */
+	IX_MEMREF(0134000,JPL)		/* JPL  */
+// TODO: Check RANGE!!!!
+	IX(0140000,0143777,SKP)		/* SKP (this one is special,
+					as if bit 7-6 = 00 its a SKIP instruction,
+					otherwise it is an extended instruction,
+					so any instruction 0140x00 where x=1,2,3,5,6,7
+					has to be added below this one*/
+
+	IX(0140120,0140120,UNIMPL)	/* ADDD  */
+	IX(0140121,0140121,UNIMPL)	/* SUBD  */
+	IX(0140122,0140122,UNIMPL)	/* COMD  */
+	IX(0140123,0140123,TSET)	/* TSET  */
+	IX(0140124,0140124,UNIMPL)	/* PACK  */
+	IX(0140125,0140125,UNIMPL)	/* UPACK */
+	IX(0140126,0140126,UNIMPL)	/* SHDE  */
+	IX(0140127,0140127,RDUS)	/* RDUS  */
+	IX(0140130,0140130,BFILL)	/* BFILL */
+	IX(0140131,0140131,MOVB)	/* MOVB  */
+	IX(0140132,0140132,MOVBF)	/* MOVBF */
+	IX(0140134,0140134,INIT)	/* INIT  */
+	IX(0140135,0140135,ENTR)	/* ENTR  */
+	IX(0140136,0140136,LEAVE)	/* LEAVE */
+	IX(0140137,0140137,ELEAV)	/* ELEAV */
+
+	IX(0140200,0140277,ILLEGAL)	/* USER1 (microcode defined by user or illegal instruction otherwise) */
+	IX(0140500,0140577,ILLEGAL)	/* USER2 (microcode defined by user or illegal instruction otherwise) */
+	IX(0140600,0140677,EXR)		/* EXR */
+	IX(0140700,0140777,ILLEGAL)	/* USER3 (microcode defined by user or illegal instruction otherwise) */
+
+	IX(0140300,0140300,SETPT)	/* SETPT */
+	IX(0140301,0140301,CLEPT)	/* CLEPT */
+
+	IX(0140302,0140302,UNIMPL)	/* CLNREENT */
+	IX(0140303,0140303,UNIMPL)	/* CHREENT-PAGES */
+	IX(0140304,0140304,UNIMPL)	/* CLEPU */
+
+	IX(0141100,0141177,ILLEGAL)	/* USER4 (microcode defined by user or illegal instruction otherwise) */
+	IX(0141200,0141277,RMPY)	/* RMPY */
+	IX(0141300,0141377,ILLEGAL)	/* USER5 (microcode defined by user or illegal instruction otherwise) */
+	IX(0141500,0141577,ILLEGAL)	/* USER6 (microcode defined by user or illegal instruction otherwise) */
+	IX(0141600,0141677,RDIV)	/* RDIV */
+	IX(0141700,0141777,ILLEGAL)	/* USER7 (microcode defined by user or illegal instruction otherwise) */
+	IX(0142100,0142177,ILLEGAL)	/* USER8 (microcode defined by user or illegal instruction otherwise) */
+	IX(0142200,0142277,LBYT)	/* LBYT */
+	IX(0142300,0142377,ILLEGAL)	/* USER9 (microcode defined by user or illegal instruction otherwise) */
+	IX(0142500,0142577,ILLEGAL)	/* USER10 (microcode defined by user or illegal instruction otherwise) */
+	IX(0142600,0142677,SBYT)	/* SBYT */
+	IX(0142700,0142777,GECO)	/* GECO - Undocumented instruction */
+	IX(0143100,0143177,MOVEW)	/* MOVEW */
+	IX(0143200,0143277,MIX3)	/* MIX3 */
+	IX(0143300,0143300,LDATX)	/* LDATX */
+	IX(0143301,0143301,LDXTX)	/* LDXTX */
+	IX(0143302,0143302,LDDTX)	/* LDDTX */
+	IX(0143303,0143303,LDBTX)	/* LDBTX */
+	IX(0143304,0143304,STATX)	/* STATX */
+	IX(0143305,0143305,STZTX)	/* STZTX */
+	IX(0143306,0143306,STDTX)	/* STDTX */
+	IX(0143500,0143500,UNIMPL)	/* LWCS */
+
+	IX(0143604,0143604,IDENT)	/* IDENT PL10 */
+	IX(0143611,0143611,IDENT)	/* IDENT PL11 */
+	IX(0143622,0143622,IDENT)	/* IDENT PL12 */
+	IX(0143643,0143643,IDENT)	/* IDENT PL13 */
+
+	[0144000] = IX_SEQ512(H_ROP), IX_SEQ512(H_ROP+01000),	/* --ROPS-- */
+		IX_SEQ512(H_ROP+02000), IX_SEQ512(H_ROP+03000),
+	IX(0150000,0150077,TRA)		/* TRA */
+	IX(0150100,0150177,TRR)		/* TRR */
+	IX(0150200,0150277,MCL)		/* MCL */
+	IX(0150300,0150377,MST)		/* MST */
+	IX(0150400,0150400,OPCOM)	/* OPCOM */
+	IX(0150401,0150401,IOF)		/* IOF */
+	IX(0150402,0150402,ION)		/* ION */
+	IX(0150404,0150404,POF)		/* POF */
+	IX(0150405,0150405,PIOF)	/* PIOF */
+	IX(0150406,0150406,SEX)		/* SEX */
+	IX(0150407,0150407,REX)		/* REX */
+	IX(0150410,0150410,PON)		/* PON */
+
+	IX(0150412,0150412,PION)	/* PION */
+
+	IX(0150415,0150415,IOXT)	/* IOXT */
+	IX(0150416,0150416,EXAM)	/* EXAM */
+	IX(0150417,0150417,DEPO)	/* DEPO */
+
+	IX(0151000,0151377,WAIT)	/* WAIT */
+	IX(0151400,0151777,NLZ)		/* NLZ */
+	IX(0152000,0152377,DNZ)		/* DNZ */
+ /* NOTE: These two seems to have bit req on 0-2 as well */
+	IX(0152400,0152577,SRB)		/* SRB */
+	IX(0152600,0152777,LRB)		/* LRB */
+	IX(0153000,0153377,MON)		/* MON */
+	IX(0153400,0153577,IRW)		/* IRW */
+	IX(0153600,0153777,IRR)		/* IRR */
+
+	IX(0154000,0157777,SHIFTS)	/* SHT, SHD, SHA, SAD */
+	IX(0164000,0167777,IOX)		/* IOX */
+	IX(0170000,0170377,SAB)		/* SAB */
+	IX(0170400,0170777,SAA)		/* SAA */
+	IX(0171000,0171377,SAT)		/* SAT */
+	IX(0171400,0171777,SAX)		/* SAX */
+	IX(0172000,0172377,AAB)		/* AAB */
+	IX(0172400,0172777,AAA)		/* AAA */
+	IX(0173000,0173377,AAT)		/* AAT */
+	IX(0173400,0173777,AAX)		/* AAX */
+	IX(0174000,0177777,BOPS)	/* Bit Operation Instructions */
+					/* Bit operations, 16 of them, 4 BSET,4 BSKP and 8 others */
+};
+
+ushort instr_index[65536];
+
+/*
+ * Set up the user ring entry for handler number h.
+ */
+static void Instruction_SetUser(ushort h) {
+	int i;
+	instr_handlers_user[h] = instr_handlers[h];
+	for (i=0;i<sizeof(instr_privileged)/sizeof(instr_privileged[0]);i++)
+		if (instr_handlers[h] == instr_privileged[i])
+			instr_handlers_user[h] = &priv_instr;
+}
+
+/*
+ * Handler number for funcpointer in instr_handlers[], adding it if needed.
+ */
+static ushort Instruction_Handler(void *funcpointer) {
+	int i;
+	for (i=0;i<instr_nhandlers;i++)
+		if (instr_handlers[i] == funcpointer)
+			return(i);
+	if (instr_nhandlers >= INSTR_HANDLERS_MAX) {
+		if (debug) fprintf(debugfile,"ERROR!!! instr_handlers full, using illegal_instr\n");
+		return(H_ILLEGAL);
+	}
+	instr_handlers[instr_nhandlers] = funcpointer;
+	Instruction_SetUser(instr_nhandlers);
+	return(instr_nhandlers++);
+}
+
 void Instruction_Add(int start, int stop, void *funcpointer) {
         int i;
-        for(i=start;i<=stop;i++)
+	ushort h = Instruction_Handler(funcpointer);
+        for(i=start;i<=stop;i++) {
+		instr_index[i] = h;
+#ifndef COMPACT_DISPATCH
                 instr_funcs[i] = funcpointer;
+		instr_funcs_user[i] = instr_handlers_user[h];
+#endif
+	}
         return;
 }
 
 /*
- * Add IO handler addresses in this function
- * This also thus actually acts as the new instruction parser also.
+ * Like Instruction_Add, but with a separate handler for each instruction
+ * in the range, taken from funcs[].
  */
-void Setup_Instructions () {
-	Instruction_Add(0000000,0177777,&ndfunc_stz);			/* First make all instructions by default point to illegal_instr  */
-
-	Instruction_Add(0000000,0003777,&ndfunc_stz);			/* STZ  */
-	Instruction_Add(0004000,0007777,&ndfunc_sta);			/* STA  */
-	Instruction_Add(0010000,0013777,&ndfunc_stt);			/* STT  */
-	Instruction_Add(0014000,0017777,&ndfunc_stx);			/* STX  */
-	Instruction_Add(0020000,0023777,&ndfunc_std);			/* STD  */
-	Instruction_Add(0024000,0027777,&ndfunc_ldd);			/* LDD  */
-	Instruction_Add(0030000,0033777,&ndfunc_stf);			/* STF  */
-	Instruction_Add(0034000,0037777,&ndfunc_ldf);			/* LDF  */
-	Instruction_Add(0040000,0043777,&ndfunc_min);			/* MIN  */
-	Instruction_Add(0044000,0047777,&ndfunc_lda);			/* LDA  */
-	Instruction_Add(0050000,0053777,&ndfunc_ldt);			/* LDT  */
-	Instruction_Add(0054000,0057777,&ndfunc_ldx);			/* LDX  */
-	Instruction_Add(0060000,0063777,&ndfunc_add);			/* ADD  */
-	Instruction_Add(0064000,0067777,&ndfunc_sub);			/* SUB  */
-	Instruction_Add(0070000,0073777,&ndfunc_and);			/* AND  */
-	Instruction_Add(0074000,0077777,&ndfunc_ora);			/* ORA  */
-	Instruction_Add(0100000,0103777,&ndfunc_fad);			/* FAD  */
-	Instruction_Add(0104000,0107777,&ndfunc_fsb);			/* FSB  */
-	Instruction_Add(0110000,0113777,&ndfunc_fmu);			/* FMU  */
-	Instruction_Add(0114000,0117777,&ndfunc_fdv);			/* FDV  */
-	Instruction_Add(0120000,0123777,&mpy);				/* MPY  */
-	Instruction_Add(0124000,0127777,&ndfunc_jmp);			/* JMP  */
-/* CJPs - Conditional jumps */
-	Instruction_Add(0130000,0130377,&ndfunc_jap);			/* JAP */
-	Instruction_Add(0130400,0130777,&ndfunc_jan);			/* JAN */
-	Instruction_Add(0131000,0131377,&ndfunc_jaz);			/* JAZ */
-	Instruction_Add(0131400,0131777,&ndfunc_jaf);			/* JAF */
-	Instruction_Add(0132000,0132377,&ndfunc_jpc);			/* JPC */
-	Instruction_Add(0132400,0132777,&ndfunc_jnc);			/* JNC */
-	Instruction_Add(0133000,0133377,&ndfunc_jxz);			/* JXZ */
-	Instruction_Add(0133400,0133777,&ndfunc_jxn);			/* JXN */
-	Instruction_Add(0134000,0137777,&ndfunc_jpl);			/* JPL  */
-// TODO: Check RANGE!!!!
-	Instruction_Add(0140000,0143777,&ndfunc_skp);			/* SKP (this one is special,
-									as if bit 7-6 = 00 its a SKIP instruction,
-									otherwise it is an extended instruction,
-									so any instruction 0140x00 where x=1,2,3,5,6,7
-									has to be added below this one*/
-
-	Instruction_Add(0140120,0140120,&unimplemented_instr);		/* ADDD  */
-	Instruction_Add(0140121,0140121,&unimplemented_instr);		/* SUBD  */
-	Instruction_Add(0140122,0140122,&unimplemented_instr);		/* COMD  */
-	Instruction_Add(0140123,0140123,&unimplemented_instr);		/* TSET  */
-	Instruction_Add(0140124,0140124,&unimplemented_instr);		/* PACK  */
-	Instruction_Add(0140125,0140125,&unimplemented_instr);		/* UPACK */
-	Instruction_Add(0140126,0140126,&unimplemented_instr);		/* SHDE  */
-	Instruction_Add(0140127,0140127,&unimplemented_instr);		/* RDUS  */
-	Instruction_Add(0140130,0140130,&ndfunc_bfill);			/* BFILL */
-	Instruction_Add(0140131,0140131,&DoMOVB);			/* MOVB  */
-	Instruction_Add(0140132,0140132,&DoMOVBF);			/* MOVBF */
-
-	switch(CurrentCPUType){
-	case ND110:
-	case ND110CE:
-	case ND110CX:
-	case ND110PCX:
-		Instruction_Add(0140133,0140133,&ndfunc_versn);		/* VERSN - ND110+ */
-		break;
-	default:
-		break;
-	}
+void Instruction_AddTable(int start, int stop, void (**funcs)(ushort)) {
+	int i;
+	for(i=start;i<=stop;i++)
+		Instruction_Add(i,i,funcs[i - start]);
+	return;
+}
 
-	Instruction_Add(0140134,0140134,&ndfunc_init);			/* INIT  */
-	Instruction_Add(0140135,0140135,&ndfunc_entr);			/* ENTR  */
-	Instruction_Add(0140136,0140136,&ndfunc_leave);			/* LEAVE */
-	Instruction_Add(0140137,0140137,&ndfunc_eleav);			/* ELEAV */
+/*
+ * Like Instruction_Add, but for memory reference instructions where
+ * funcs holds one handler for each of the 8 addressing modes.
+ */
+void Instruction_AddModes(int start, int stop, void (*funcs[8])(ushort)) {
+	int i;
+	for(i=start;i<=stop;i++)
+		Instruction_Add(i,i,funcs[(i >> 8) & 0x07]);
+	return;
+}
 
-	Instruction_Add(0140200,0140277,&illegal_instr);		/* USER1 (microcode defined by user or illegal instruction otherwise) */
+/*
+ * Set up instruction decoding for the current cpu type.
+ * The ND100 layout is in instr_index_init, only the differences
+ * for other cpu types are added here.
+ */
+void Setup_Instructions () {
+	int i;
 
+	memcpy(instr_index,instr_index_init,sizeof(instr_index));
+	instr_nhandlers = H_COUNT;
+	for (i=0;i<H_COUNT;i++)
+		Instruction_SetUser(i);
 
 	switch(CurrentCPUType){
 	case ND110:
 	case ND110CE:
 	case ND110CX:
 	case ND110PCX:
+		Instruction_Add(0140133,0140133,&ndfunc_versn);		/* VERSN - ND110+ */
+
+		Instruction_Add(0140500,0140577,&ndfunc_skp);		/* No USER2 on ND110 */
 		Instruction_Add(0140500,0140500,&unimplemented_instr);	/* WGLOB - ND110 Specific */
 		Instruction_Add(0140501,0140501,&unimplemented_instr);	/* RGLOB - ND110 Specific */
 		Instruction_Add(0140502,0140502,&unimplemented_instr);	/* INSPL - ND110 Specific */
@@ -3905,18 +4914,8 @@ void Setup_Instructions () {
 		Instruction_Add(0140515,0140515,&unimplemented_instr);	/* SBYTP - ND110 Specific */
 		Instruction_Add(0140516,0140516,&unimplemented_instr);	/* TSETP - ND110 Specific */
 		Instruction_Add(0140517,0140517,&unimplemented_instr);	/* RDUSP - ND110 Specific */
-		break;
-	default:
-		Instruction_Add(0140500,0140577,&illegal_instr);	/* USER2 (microcode defined by user or illegal instruction otherwise) */
-		break;
-	}
 
-	Instruction_Add(0140600,0140677,&DoEXR);			/* EXR */
-	switch(CurrentCPUType){
-	case ND110:
-	case ND110CE:
-	case ND110CX:
-	case ND110PCX:
+		Instruction_Add(0140700,0140777,&ndfunc_skp);		/* No USER3 on ND110 */
 		Instruction_Add(0140700,0140700,&unimplemented_instr);	/* LASB - ND110 Specific */
 		Instruction_Add(0140701,0140701,&unimplemented_instr);	/* SASB - ND110 Specific */
 		Instruction_Add(0140702,0140702,&unimplemented_instr);	/* LACB - ND110 Specific */
@@ -3925,119 +4924,98 @@ void Setup_Instructions () {
 		Instruction_Add(0140705,0140705,&unimplemented_instr);	/* LXCB - ND110 Specific */
 		Instruction_Add(0140706,0140706,&unimplemented_instr);	/* SZSB - ND110 Specific */
 		Instruction_Add(0140707,0140707,&unimplemented_instr);	/* SZCB - ND110 Specific */
+		/* LWCS not implemented on ND110 due to microcode format changes, should become a NOOP */
 		break;
 	default:
-		Instruction_Add(0140700,0140777,&illegal_instr);	/* USER3 (microcode defined by user or illegal instruction otherwise) */
-		break;
-	}
-
-	Instruction_Add(0140300,0140300,&ndfunc_setpt);			/* SETPT */
-	Instruction_Add(0140301,0140301,&ndfunc_clept);			/* CLEPT */
-
-	Instruction_Add(0140302,0140302,&unimplemented_instr);		/* CLNREENT */
-	Instruction_Add(0140303,0140303,&unimplemented_instr);		/* CHREENT-PAGES */
-	Instruction_Add(0140304,0140304,&unimplemented_instr);		/* CLEPU */
-
-	Instruction_Add(0141100,0141177,&illegal_instr);		/* USER4 (microcode defined by user or illegal instruction otherwise) */
-	Instruction_Add(0141200,0141277,&rmpy);				/* RMPY */
-	Instruction_Add(0141300,0141377,&illegal_instr);		/* USER5 (microcode defined by user or illegal instruction otherwise) */
-	Instruction_Add(0141500,0141577,&illegal_instr);		/* USER6 (microcode defined by user or illegal instruction otherwise) */
-	Instruction_Add(0141600,0141677,&rdiv);				/* RDIV */
-	Instruction_Add(0141700,0141777,&illegal_instr);		/* USER7 (microcode defined by user or illegal instruction otherwise) */
-	Instruction_Add(0142100,0142177,&illegal_instr);		/* USER8 (microcode defined by user or illegal instruction otherwise) */
-	Instruction_Add(0142200,0142277,&ndfunc_lbyt);			/* LBYT */
-	Instruction_Add(0142300,0142377,&illegal_instr);		/* USER9 (microcode defined by user or illegal instruction otherwise) */
-	Instruction_Add(0142500,0142577,&illegal_instr);		/* USER10 (microcode defined by user or illegal instruction otherwise) */
-	Instruction_Add(0142600,0142677,&ndfunc_sbyt);			/* SBYT */
-	Instruction_Add(0142700,0142777,&ndfunc_geco);			/* GECO - Undocumented instruction */
-	Instruction_Add(0143100,0143177,&unimplemented_instr);		/* MOVEW */
-	Instruction_Add(0143200,0143277,&ndfunc_mix3);			/* MIX3 */
-	Instruction_Add(0143300,0143300,&ndfunc_ldatx);			/* LDATX */
-	Instruction_Add(0143301,0143301,&ndfunc_ldxtx);			/* LDXTX */
-	Instruction_Add(0143302,0143302,&ndfunc_lddtx);			/* LDDTX */
-	Instruction_Add(0143303,0143303,&ndfunc_ldbtx);			/* LDBTX */
-	Instruction_Add(0143304,0143304,&ndfunc_statx);			/* STATX */
-	Instruction_Add(0143305,0143305,&ndfunc_stztx);			/* STZTX */
-	Instruction_Add(0143306,0143306,&ndfunc_stdtx);			/* STDTX */
-
-	switch(CurrentCPUType){
-	case ND110:		/* Not implemented on ND110 due to microcode format changes */
-	case ND110CE:		/* Should become a NOOOP on these */
-	case ND110CX:
-	case ND110PCX:
-		Instruction_Add(0143500,0143500,&unimplemented_instr);	/* LWCS */
-		break;
-	default:
-		Instruction_Add(0143500,0143500,&unimplemented_instr);	/* LWCS */
 		break;
 	}
-
-	Instruction_Add(0143604,0143604,&ndfunc_ident);			/* IDENT PL10 */
-
-	Instruction_Add(0143611,0143611,&ndfunc_ident);			/* IDENT PL11 */
-
-	Instruction_Add(0143622,0143622,&ndfunc_ident);			/* IDENT PL12 */
-
-	Instruction_Add(0143643,0143643,&ndfunc_ident);			/* IDENT PL13 */
-
-	Instruction_Add(0144000,0147777,&regop);			/* --ROPS-- */
-	Instruction_Add(0150000,0150077,&DoTRA);			/* TRA */
-	Instruction_Add(0150100,0150177,&DoTRR);			/* TRR */
-	Instruction_Add(0150200,0150277,&DoMCL);			/* MCL */
-	Instruction_Add(0150300,0150377,&DoMST);			/* MST */
-	Instruction_Add(0150400,0150400,&ndfunc_opcom);			/* OPCOM */
-	Instruction_Add(0150401,0150401,&ndfunc_iof);			/* IOF */
-	Instruction_Add(0150402,0150402,&ndfunc_ion);			/* ION */
 	switch(CurrentCPUType){
 	case ND110PCX:
 		/* ND110 Butterfly only instruction */
 		Instruction_Add(0150403,0150403,&unimplemented_instr);	/* RTNSIM (SECRE) */
 		break;
-	default:
-		break;
-	}
-	Instruction_Add(0150404,0150404,&ndfunc_pof);			/* POF */
-	Instruction_Add(0150405,0150405,&ndfunc_piof);			/* PIOF */
-	Instruction_Add(0150406,0150406,&ndfunc_sex);			/* SEX */
-	Instruction_Add(0150407,0150407,&ndfunc_rex);			/* REX */
-	Instruction_Add(0150410,0150410,&ndfunc_pon);			/* PON */
-
-	Instruction_Add(0150412,0150412,&ndfunc_pion);			/* PION */
-
-	Instruction_Add(0150415,0150415,&ndfunc_ioxt);			/* IOXT */
-	Instruction_Add(0150416,0150416,&ndfunc_exam);			/* EXAM */
-	Instruction_Add(0150417,0150417,&ndfunc_depo);			/* DEPO */
-
-	Instruction_Add(0151000,0151377,&DoWAIT);			/* WAIT */
-	Instruction_Add(0151400,0151777,&ndfunc_nlz);			/* NLZ */
-	Instruction_Add(0152000,0152377,&ndfunc_dnz);			/* DNZ */
- /* NOTE: These two seems to have bit req on 0-2 as well */
-	Instruction_Add(0152400,0152577,&ndfunc_srb);			/* SRB */
-	Instruction_Add(0152600,0152777,&ndfunc_lrb);			/* LRB */
-	Instruction_Add(0153000,0153377,&ndfunc_mon);			/* MON */
-	Instruction_Add(0153400,0153577,&ndfunc_irw);			/* IRW */
-	Instruction_Add(0153600,0153777,&ndfunc_irr);			/* IRR */
-
-	Instruction_Add(0154000,0157777,&ndfunc_shifts);		/* SHT, SHD, SHA, SAD */
 /* NOTE: this is actually a ND1 instruction, so need to check which NDs implement it later */
-	switch(CurrentCPUType){
 	case ND1:
 		/* ND1 only instruction */
-		Instruction_Add(0160000,01163777,&ndfunc_iot);		/* IOT */
+		Instruction_Add(0160000,0163777,&ndfunc_iot);		/* IOT */
 		break;
 	default:
 		break;
 	}
-	Instruction_Add(0164000,0167777,&ndfunc_iox);			/* IOX */
-	Instruction_Add(0170000,0170377,&ndfunc_sab);			/* SAB */
-	Instruction_Add(0170400,0170777,&ndfunc_saa);			/* SAA */
-	Instruction_Add(0171000,0171377,&ndfunc_sat);			/* SAT */
-	Instruction_Add(0171400,0171777,&ndfunc_sax);			/* SAX */
-	Instruction_Add(0172000,0172377,&ndfunc_aab);			/* AAB */
-	Instruction_Add(0172400,0172777,&ndfunc_aaa);			/* AAA */
-	Instruction_Add(0173000,0173377,&ndfunc_aat);			/* AAT */
-	Instruction_Add(0173400,0173777,&ndfunc_aax);			/* AAX */
-	Instruction_Add(0174000,0177777,&do_bops);			/* Bit Operation Instructions */
-									/* Bit operations, 16 of them, 4 BSET,4 BSKP and 8 others */
+	LoadExtensions();	/* Native handlers for the USERx slots */
+
+#ifndef COMPACT_DISPATCH
+	for (i=0;i<65536;i++) {
+		instr_funcs[i] = instr_handlers[instr_index[i]];
+		instr_funcs_user[i] = instr_handlers_user[instr_index[i]];
+	}
+#endif
+	Setup_BlockCache();	/* Handlers may have changed, so start with an empty block cache */
+#ifdef THREADED_DISPATCH
+	ThreadedRun(0);		/* Rebuild the threaded dispatch table */
+#endif
 }
 
+
+/*
+ * DispatchBench - Compare finding instruction handlers through a flat
+ * 64K pointer table (512 KB) and through instr_index/instr_handlers.
+ * Run with "nd100em -dispatchbench". Instruction words are random over
+ * all 64K, and each lookup also reads a random word of guest memory, the
+ * way fetching the instruction would, so the tables compete for cache
+ * like they do when running.
+ */
+#define BENCH_OPS	(1<<20)
+#define BENCH_ROUNDS	32
+void DispatchBench(void) {
+	void (**flat)(ushort);
+	void (*func)(ushort);
+	ushort *ops;
+	unsigned int *addrs;
+	unsigned long acc = 0;
+	struct timeval t0, t1;
+	double secs;
+	int i, r, layout;
+
+	flat = malloc(65536 * sizeof(*flat));
+	ops = malloc(BENCH_OPS * sizeof(*ops));
+	addrs = malloc(BENCH_OPS * sizeof(*addrs));
+	if (!flat || !ops || !addrs) {
+		fprintf(stderr,"DispatchBench: out of memory\n");
+		return;
+	}
+	for (i=0;i<65536;i++)
+		flat[i] = instr_handlers[instr_index[i]];
+	srand(1);
+	for (i=0;i<BENCH_OPS;i++) {
+		ops[i] = rand() & 0xffff;
+		addrs[i] = rand() % ND_Memsize;
+	}
+
+	for (layout=0;layout<2;layout++) {
+		gettimeofday(&t0,NULL);
+		for (r=0;r<BENCH_ROUNDS;r++) {
+			if (layout) {
+				for (i=0;i<BENCH_OPS;i++) {
+					func = instr_handlers[instr_index[ops[i]]];
+					acc += (unsigned long)func + VolatileMemory->n_Array[addrs[i]];
+				}
+			} else {
+				for (i=0;i<BENCH_OPS;i++) {
+					func = flat[ops[i]];
+					acc += (unsigned long)func + VolatileMemory->n_Array[addrs[i]];
+				}
+			}
+		}
+		gettimeofday(&t1,NULL);
+		secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1000000.0;
+		printf("%s dispatch table: %7d KB, %.1f million lookups/s\n",
+			(layout) ? "compact" : "flat   ",
+			(layout) ? (int)((sizeof(instr_index) + instr_nhandlers * sizeof(*instr_handlers)) / 1024) : (int)(65536 * sizeof(*flat) / 1024),
+			(double)BENCH_OPS * BENCH_ROUNDS / secs / 1000000.0);
+	}
+	printf("(checksum %lx)\n",acc);
+	free(flat);
+	free(ops);
+	free(addrs);
+}
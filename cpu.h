@@ -60,19 +60,20 @@ extern int emulatemon;
 /* NEW ORGANIZATION OF MEMORY AND REGISTERS!!    */
 /*************************************************/
 
-/* NOTE: Memory part not implemented yet!! */
-
-_NDRAM_		VolatileMemory;
+/* Guest memory, mapped by setup_memory */
+_NDRAM_		*VolatileMemory;
 _NDPT_		PageTable;
 _RUNMODE_	CurrentCPURunMode;
 _CPUTYPE_	CurrentCPUType;
 
 struct CpuRegs *gReg;
 union NewPT *gPT;
+struct PageBits *gPageBits;
 struct MemTraceList *gMemTrace;
 struct IdentChain *gIdentChain;
 
-#define ND_Memsize	(sizeof(VolatileMemory)/sizeof(ushort))
+/* Words of guest memory, a power of two, from memsize in nd100em.conf */
+ulong ND_Memsize = MEMPTSIZE*1024;
 
 /*
  * NEW INSTRUCTION HANDLING!!
@@ -82,8 +83,31 @@ struct IdentChain *gIdentChain;
  * Even with optimized branch table handling, this should be way faster
  * It also makes possible modifications to instruction handling at runtime, for possible
  * implementation of USER instructions etc.
+ * With COMPACT_DISPATCH the compact instr_index/instr_handlers tables in
+ * cpu.c are used instead.
+ * The _user tables are the same with privileged instructions trapping,
+ * used in rings 0 and 1 when memory management is on.
  */
+#ifndef COMPACT_DISPATCH
 void (*instr_funcs[65536])(ushort);
+void (*instr_funcs_user[65536])(ushort);
+#endif
+extern ushort instr_index[65536];
+extern void (*instr_handlers[])(ushort);
+extern void (*instr_handlers_user[])(ushort);
+extern int instr_nhandlers;
+
+/* Tables CacheSTS picks myreg_DISP from */
+#ifdef COMPACT_DISPATCH
+#define DISP_SYSTEM	instr_handlers
+#define DISP_USER	instr_handlers_user
+#else
+#define DISP_SYSTEM	instr_funcs
+#define DISP_USER	instr_funcs_user
+#endif
+
+/* Size of instr_handlers[], the built in handlers plus room for those added with Instruction_Add */
+#define INSTR_HANDLERS_MAX	4096
 
 /*************************************************/
 
@@ -98,34 +122,34 @@ unsigned short MODE_OPCOM=0;
 /* This variable tells us if we have the display panel option */
 unsigned short PANEL_PROCESSOR=0;
 
-void ndfunc_stz(ushort operand);
-void ndfunc_sta(ushort operand);
-void ndfunc_stt(ushort operand);
-void ndfunc_stx(ushort operand);
-void ndfunc_std(ushort operand);
-void ndfunc_stf(ushort operand);
+extern void (*ndfunc_stz_mode[8])(ushort);
+extern void (*ndfunc_sta_mode[8])(ushort);
+extern void (*ndfunc_stt_mode[8])(ushort);
+extern void (*ndfunc_stx_mode[8])(ushort);
+extern void (*ndfunc_std_mode[8])(ushort);
+extern void (*ndfunc_stf_mode[8])(ushort);
 void ndfunc_stztx(ushort operand);
 void ndfunc_statx(ushort operand);
 void ndfunc_stdtx(ushort operand);
-void ndfunc_lda(ushort operand);
-void ndfunc_ldt(ushort operand);
-void ndfunc_ldx(ushort operand);
-void ndfunc_ldd(ushort operand);
-void ndfunc_ldf(ushort operand);
+extern void (*ndfunc_lda_mode[8])(ushort);
+extern void (*ndfunc_ldt_mode[8])(ushort);
+extern void (*ndfunc_ldx_mode[8])(ushort);
+extern void (*ndfunc_ldd_mode[8])(ushort);
+extern void (*ndfunc_ldf_mode[8])(ushort);
 void ndfunc_ldatx(ushort operand);
 void ndfunc_ldxtx(ushort operand);
 void ndfunc_lddtx(ushort operand);
 void ndfunc_ldbtx(ushort operand);
-void ndfunc_min(ushort operand);
-void ndfunc_add(ushort operand);
-void ndfunc_sub(ushort operand);
-void ndfunc_and(ushort operand);
-void ndfunc_ora(ushort operand);
-void ndfunc_fad(ushort operand);
-void ndfunc_fsb(ushort operand);
-void ndfunc_fmu(ushort operand);
-void ndfunc_fdv(ushort operand);
-void ndfunc_jmp(ushort operand);
+extern void (*ndfunc_min_mode[8])(ushort);
+extern void (*ndfunc_add_mode[8])(ushort);
+extern void (*ndfunc_sub_mode[8])(ushort);
+extern void (*ndfunc_and_mode[8])(ushort);
+extern void (*ndfunc_ora_mode[8])(ushort);
+extern void (*ndfunc_fad_mode[8])(ushort);
+extern void (*ndfunc_fsb_mode[8])(ushort);
+extern void (*ndfunc_fmu_mode[8])(ushort);
+extern void (*ndfunc_fdv_mode[8])(ushort);
+extern void (*ndfunc_jmp_mode[8])(ushort);
 void ndfunc_geco(ushort operand);
 void ndfunc_versn(ushort operand);
 void ndfunc_iox(ushort operand);
@@ -168,9 +192,12 @@ void ndfunc_jpc(ushort operand);
 void ndfunc_jnc(ushort operand);
 void ndfunc_jxz(ushort operand);
 void ndfunc_jxn(ushort operand);
-void ndfunc_jpl(ushort operand);
+extern void (*ndfunc_jpl_mode[8])(ushort);
 void ndfunc_skp(ushort operand);
 void ndfunc_bfill(ushort operand);
+void ndfunc_tset(ushort operand);
+void ndfunc_rdus(ushort operand);
+void ndfunc_movew(ushort operand);
 void ndfunc_init(ushort operand);
 void ndfunc_entr(ushort operand);
 void ndfunc_leave(ushort operand);
@@ -183,6 +210,7 @@ void OpToStr(char *opstr, ushort operand);
 void do_op(unsigned short operand);
 void new_regop (unsigned short operand);
 void regop (unsigned short operand);
+extern void (*regop_funcs[2048])(ushort);
 void do_skp(unsigned short operand);
 void do_bops(unsigned short operand);
 void compare_jumps(unsigned short operand);
@@ -194,7 +222,7 @@ void add_A_mem(ushort eff_addr, bool UseAPT);
 void sub_A_mem(ushort eff_addr, bool UseAPT);
 void rdiv(ushort instr); 
 void rmpy(ushort instr);
-void mpy(ushort instr);
+extern void (*mpy_mode[8])(ushort);
 void do_irr(unsigned short operand);
 void do_irw(unsigned short operand);
 void DoSRB(ushort operand);
@@ -217,6 +245,8 @@ void do_debug_txt(char *txt);
 void debug_regs(void);
 void setbit_STS_MSB(ushort stsbit, char val);
 void AdjustSTS(ushort reg_a, ushort operand, int result);
+void SyncSTS(void);
+void CacheSTS(void);
 void clrbit(unsigned short regnum, unsigned short stsbit);
 void setbit(unsigned short regnum, unsigned short stsbit, char val);
 unsigned short getbit(unsigned short regnum, unsigned short stsbit);
@@ -227,6 +257,8 @@ void setcbreak (void);
 bool IsSkip(ushort instr);
 ushort GetEffectiveAddr(ushort instr);
 ushort New_GetEffectiveAddr(ushort instr, bool *use_apt);
+bool IsShadowMemAccess(ulong addr);
+void PageBitsSync(void);
 void PT_Write(ushort value, ushort addr, ushort byte_select);
 ushort PT_Read(ushort addr);
 void PhysMemWrite(ushort value, ulong addr);
@@ -234,21 +266,34 @@ ushort PhysMemRead(ulong addr);
 void MemoryWrite(ushort value, ushort addr, bool is_P_relative, unsigned char byte_select);
 ushort MemoryRead(ushort addr, bool is_P_relative);
 ushort MemoryFetch(ushort addr, bool is_P_relative);
+ushort *MemoryPage(ushort vpn, bool UseAPT, bool write);
 void AddMemTrace(unsigned int addr, char whom);
 void DelMemTrace();
 void PrintMemTrace();
 void AddIdentChain(char lvl, ushort identnum, int callerid);
 void RemIdentChain(struct IdentChain * elem);
 void checkPK (void);
+void PostEvent(int evt);
+void DoEvents(void);
 void interrupt(ushort lvl,ushort sub);
 void illegal_instr(ushort operand);
+void priv_instr(ushort operand);
 void unimplemented_instr(ushort operand);
 void prefetch();
+#ifdef THREADED_DISPATCH
+int ThreadedRun(int limit);
+#endif
 void cpu_thread();
 void mopc_thread();
 
 void Instruction_Add(int start, int stop, void *funcpointer);
+void Instruction_AddTable(int start, int stop, void (**funcs)(ushort));
+void Instruction_AddModes(int start, int stop, void (*funcs[8])(ushort));
 void Setup_Instructions ();
+void DispatchBench(void);
+extern void LoadExtensions(void);
+void TlbFlush(void);
+void TlbFlushLevel(ushort level);
 
 extern void mon (unsigned char monnum);
 extern void io_op (ushort ioadd);
@@ -277,5 +322,21 @@ extern void disasm_setlbl(ushort addr);
 extern void disasm_userel(ushort addr, ushort where);
 extern void disasm_set_isdata(ushort addr);
 
+extern unsigned char bc_pagemap[];
+extern volatile int bc_break;
+extern volatile int cpu_events;
+extern int BLOCK_CACHE;
+extern void Setup_BlockCache(void);
+extern void BlockCacheWrite(ulong paddr);
+extern int BlockRun(ulong paddr);
+
+extern unsigned long long *hm_count;
+extern int HEATMAP_LEVELS;
+extern void HeatmapDump(void);
+
+extern unsigned long long wp_vpn;
+extern void WatchMap(void);
+extern void WatchEvents(void);
+
 extern sem_t sem_pap;
 extern struct display_panel *gPAP;
@@ -0,0 +1,152 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * Native extension instructions.
+ *
+ * The real ND-100 let the user add microcode in the USER1..USER10
+ * instruction slots. Here the slots can instead be given to native
+ * handlers in shared objects, loaded from the "extensions" list in
+ * nd100em.conf. The interface an extension sees is in nd100ext.h.
+ *
+ * Each slot gets its own small handler in the dispatch tables, which
+ * syncs STS, calls the extension and then moves P on like any other
+ * instruction. Slots nobody claims stay illegal instructions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <dlfcn.h>
+#include "nd100.h"
+#include "nd100ext.h"
+#include "ext.h"
+
+/* First instruction of each slot, 64 instructions in each */
+static const ushort ext_slot_base[11] = {
+	0,
+	0140200, 0140500, 0140700, 0141100, 0141300,	/* USER1 - USER5 */
+	0141500, 0141700, 0142100, 0142300, 0142500	/* USER6 - USER10 */
+};
+
+static int (*ext_handler[11])(unsigned short instr);
+
+/*
+ * Run the extension handler for slot on instruction operand.
+ */
+static void ext_call(int slot, ushort operand) {
+	SyncSTS();	/* Let the handler see and change C, O and Q directly */
+	switch (ext_handler[slot](operand)) {
+	case ND100EXT_NEXT:
+		gPC++;
+		break;
+	case ND100EXT_JUMP:
+		break;
+	default:
+		illegal_instr(operand);
+		break;
+	}
+}
+
+#define EXT_SLOT(n)	static void ext_slot_##n(ushort operand) { ext_call(n,operand); }
+EXT_SLOT(1) EXT_SLOT(2) EXT_SLOT(3) EXT_SLOT(4) EXT_SLOT(5)
+EXT_SLOT(6) EXT_SLOT(7) EXT_SLOT(8) EXT_SLOT(9) EXT_SLOT(10)
+
+static void (*const ext_slot_func[11])(ushort) = {
+	NULL, ext_slot_1, ext_slot_2, ext_slot_3, ext_slot_4, ext_slot_5,
+	ext_slot_6, ext_slot_7, ext_slot_8, ext_slot_9, ext_slot_10
+};
+
+/*
+ * The nd100ext_api functions.
+ */
+static unsigned short *ext_regs(void) {
+	return(gReg->myreg_CUR);
+}
+
+static unsigned short ext_read(unsigned short addr, int apt) {
+	return(MemoryRead(addr,apt ? true : false));
+}
+
+static void ext_write(unsigned short value, unsigned short addr, int apt, int byte_select) {
+	if ((byte_select < ND100EXT_MSB) || (byte_select > ND100EXT_WORD))
+		return;
+	MemoryWrite(value,addr,apt ? true : false,byte_select);
+}
+
+static int ext_register_slot(int slot, int (*handler)(unsigned short instr)) {
+	if ((slot < 1) || (slot > 10) || !handler || ext_handler[slot])
+		return(-1);
+	switch(CurrentCPUType){
+	case ND110:		/* USER2 and USER3 hold ND110 instructions */
+	case ND110CE:
+	case ND110CX:
+	case ND110PCX:
+		if ((slot == 2) || (slot == 3))
+			return(-1);
+		break;
+	default:
+		break;
+	}
+	ext_handler[slot] = handler;
+	Instruction_Add(ext_slot_base[slot],ext_slot_base[slot] + 077,ext_slot_func[slot]);
+	return(0);
+}
+
+static const struct nd100ext_api ext_api = {
+	ND100EXT_VERSION,
+	ext_regs,
+	ext_read,
+	ext_write,
+	ext_register_slot
+};
+
+/*
+ * Load the extensions in EXT_FILES and let them claim their slots.
+ * Called from Setup_Instructions, so the dispatch tables are fresh and
+ * the slots free. A file that can not be loaded is reported and skipped.
+ */
+void LoadExtensions(void) {
+	static void *handles[EXT_MAX];
+	nd100ext_init_t init;
+	int i;
+
+	memset(ext_handler,0,sizeof(ext_handler));
+	for (i=0;i<EXT_COUNT;i++) {
+		if (!handles[i])
+			handles[i] = dlopen(EXT_FILES[i],RTLD_NOW | RTLD_LOCAL);
+		if (!handles[i]) {
+			fprintf(stderr,"Could not load extension %s: %s\n",EXT_FILES[i],dlerror());
+			continue;
+		}
+		init = (nd100ext_init_t)dlsym(handles[i],ND100EXT_INIT);
+		if (!init) {
+			fprintf(stderr,"Extension %s has no %s\n",EXT_FILES[i],ND100EXT_INIT);
+			continue;
+		}
+		if (init(&ext_api))
+			fprintf(stderr,"Extension %s failed to initialize\n",EXT_FILES[i]);
+		else if (debug)
+			fprintf(debugfile,"Loaded extension %s\n",EXT_FILES[i]);
+	}
+}
@@ -0,0 +1,42 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * Native extension instructions in the USER1..USER10 slots, see nd100ext.h
+ */
+
+/* Config, shared objects to load, set from "extensions" in nd100em.conf */
+char *EXT_FILES[EXT_MAX];
+int EXT_COUNT = 0;
+
+extern struct CpuRegs *gReg;
+extern _CPUTYPE_ CurrentCPUType;
+extern int debug;
+extern FILE *debugfile;
+
+void LoadExtensions(void);
+
+extern void Instruction_Add(int start, int stop, void *funcpointer);
+extern void illegal_instr(ushort operand);
+extern void SyncSTS(void);
+extern ushort MemoryRead(ushort addr, bool is_P_relative);
+extern void MemoryWrite(ushort value, ushort addr, bool is_P_relative, unsigned char byte_select);
@@ -0,0 +1,359 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Superinstructions for the block cache.
+ *
+ * When a cached block has been run FUSE_THRESHOLD times, BlockFuse looks
+ * for some common instruction sequences in it and replaces them with one
+ * handler doing the whole sequence:
+ *	LDA / ADD / STA		(direct, B, X and B+X addressing)
+ *	LDX / JXZ
+ *	SKP / JMP
+ *	AAX / JXN		(loop tails)
+ *	STZ / AAX 1 / JXN	(clear loop, done with memset)
+ *	LDA / STA / AAX 1 / JXN	(copy loop, done with memmove)
+ * Memory accesses in a superinstruction use MemoryPage to translate each
+ * page once. If any of them would fault, hit shadow memory or write to
+ * cached code, the sequence is run one instruction at a time through the
+ * normal handlers instead, so faults and interrupts happen exactly where
+ * they would without fusion. EXR never becomes part of a superinstruction,
+ * it always ends a block.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "nd100.h"
+#include "fuse.h"
+
+/* Direct addressing modes, no indirection: (P), (B), (X), (B)+(X) */
+#define FUSE_DIRECT(instr)	((1 << (((instr) >> 8) & 0x07)) & 0x33)
+
+/* Loop rounds done natively per call, so interrupts are not held off for long */
+#define FUSE_LOOP_MAX	1024
+
+/* Sign extended displacement of an instruction */
+#define FUSE_DISP(instr)	((ushort)(sshort)(char)((instr) & 0xff))
+
+/* The page translation kept between the accesses of one superinstruction */
+struct fuse_tc {
+	ushort	vpn;
+	bool	apt;
+	bool	write;
+	ushort	*page;
+};
+
+/*
+ * Effective address of a direct mode memory reference instruction at p.
+ */
+static ushort fuse_ea(ushort instr, ushort p, bool *apt) {
+	*apt = true;
+	switch ((instr >> 8) & 0x07) {
+	case 0:	/* (P) + disp */
+		*apt = false;
+		return(p + FUSE_DISP(instr));
+	case 1:	/* (B) + disp */
+		return(gB + FUSE_DISP(instr));
+	case 4:	/* (X) + disp */
+		return(gX + FUSE_DISP(instr));
+	default: /* (B) + disp + (X) */
+		return(gB + gX + FUSE_DISP(instr));
+	}
+}
+
+/*
+ * Host address of the word at addr, reusing the last translation if it
+ * was for the same page. NULL if a plain access is not possible.
+ */
+static ushort *fuse_ptr(struct fuse_tc *tc, ushort addr, bool apt, bool write) {
+	ushort vpn = addr >> 10;
+	if (!tc->page || (tc->vpn != vpn) || (tc->apt != apt) || (write && !tc->write)) {
+		tc->page = MemoryPage(vpn,apt,write);
+		tc->vpn = vpn;
+		tc->apt = apt;
+		tc->write = write;
+		if (!tc->page)
+			return(NULL);
+	}
+	return(&tc->page[addr & 01777]);
+}
+
+/*
+ * Run n instructions the normal way, with the same stop checks as BlockRun.
+ * Returns the number of instructions executed.
+ */
+static int fuse_step(ushort *instr, int n) {
+	ushort p;
+	int i = 0;
+	while (i < n) {
+		p = gPC;
+		INSTR_FUNC(instr[i])(instr[i]);
+		i++;
+		if (bc_break || (gPC != (ushort)(p + 1)))
+			break;
+	}
+	return(i);
+}
+
+/*
+ * LDA a / ADD b / STA c
+ */
+static int fuse_lda_add_sta(ushort *instr) {
+	struct fuse_tc tc = { 0, false, false, NULL };
+	ushort p = gPC;
+	ushort *a1, *a2, *a3;
+	ushort ea;
+	bool apt;
+
+	ea = fuse_ea(instr[0],p,&apt);
+	a1 = fuse_ptr(&tc,ea,apt,false);
+	if (!a1)
+		return(fuse_step(instr,3));
+	ea = fuse_ea(instr[1],p + 1,&apt);
+	a2 = fuse_ptr(&tc,ea,apt,false);
+	if (!a2)
+		return(fuse_step(instr,3));
+	ea = fuse_ea(instr[2],p + 2,&apt);
+	a3 = fuse_ptr(&tc,ea,apt,true);
+	if (!a3)
+		return(fuse_step(instr,3));
+	HEAT(HM_READ,a1 - VolatileMemory->n_Array);	/* only now, the handlers count their own */
+	HEAT(HM_READ,a2 - VolatileMemory->n_Array);
+	HEAT(HM_WRITE,a3 - VolatileMemory->n_Array);
+	gA = do_add(*a1,*a2,0);
+	*a3 = gA;
+	gPC = p + 3;
+	return(3);
+}
+
+/*
+ * LDX a / JXZ d
+ */
+static int fuse_ldx_jxz(ushort *instr) {
+	struct fuse_tc tc = { 0, false, false, NULL };
+	ushort p = gPC;
+	ushort *a;
+	ushort ea;
+	bool apt;
+
+	ea = fuse_ea(instr[0],p,&apt);
+	a = fuse_ptr(&tc,ea,apt,false);
+	if (!a)
+		return(fuse_step(instr,2));
+	HEAT(HM_READ,a - VolatileMemory->n_Array);
+	gX = *a;
+	if (gX == 0)
+		gPC = do_add(p + 1,FUSE_DISP(instr[1]),0);
+	else
+		gPC = p + 2;
+	return(2);
+}
+
+/*
+ * SKP / JMP, the jump is only run if the skip was not taken.
+ */
+static int fuse_skp_jmp(ushort *instr) {
+	gPC++;
+	if (IsSkip(instr[0])) {
+		gPC++;
+		return(1);
+	}
+	INSTR_FUNC(instr[1])(instr[1]);
+	return(2);
+}
+
+/*
+ * AAX k / JXN d
+ */
+static int fuse_aax_jxn(ushort *instr) {
+	ushort p = gPC;
+
+	gX = do_add(gX,FUSE_DISP(instr[0]),0);
+	if (gX & (1<<15))
+		gPC = do_add(p + 1,FUSE_DISP(instr[1]),0);
+	else
+		gPC = p + 2;
+	return(2);
+}
+
+/*
+ * Number of words from addr to the end of its page.
+ */
+static int fuse_pageleft(ushort addr) {
+	return(1024 - (addr & 01777));
+}
+
+/*
+ * Clear loop:	STZ d,X (or d,B,X) / AAX 1 / JXN *-2
+ * Zeroes one page worth of words at a time with memset. The last round
+ * is always left to the handlers, so X, P and the flags come out of the
+ * loop exactly as from the guest code. Before that each round ends with
+ * the jump taken, which sets C and Q, and the AAX can never overflow with
+ * X negative, so the flags are those of one JXN add.
+ */
+static int fuse_clear_loop(ushort *instr) {
+	ushort p = gPC;
+	ushort *page, addr;
+	int left, m, n = 0;
+	bool apt;
+
+	left = (gX & 0x8000) ? 0x10000 - gX : 0;	/* rounds until X is 0 */
+	while ((left > 1) && (n < FUSE_LOOP_MAX)) {
+		addr = fuse_ea(instr[0],p,&apt);
+		page = MemoryPage(addr >> 10,apt,true);
+		if (!page)
+			break;
+		m = left - 1;
+		if (m > fuse_pageleft(addr)) m = fuse_pageleft(addr);
+		if (m > FUSE_LOOP_MAX - n) m = FUSE_LOOP_MAX - n;
+		memset(&page[addr & 01777],0,m * sizeof(ushort));
+		HEAT_N(HM_WRITE,page - VolatileMemory->n_Array,m);	/* as many as word by word */
+		gX += m;
+		left -= m;
+		n += m;
+	}
+	if (!n)
+		return(fuse_step(instr,3));
+	gPC = do_add(p + 2,FUSE_DISP(instr[2]),0);
+	return(3 * n);
+}
+
+/*
+ * Copy loop:	LDA d,X / STA e,X (either may also be B+X) / AAX 1 / JXN *-3
+ * Like the clear loop, but copying. The guest copies forward one word
+ * at a time, so if the destination starts inside the source that has
+ * to be done the same way to get the same repeating pattern, otherwise
+ * memmove gives the same result.
+ */
+static int fuse_copy_loop(ushort *instr) {
+	ushort p = gPC;
+	ushort *spage, *dpage, *s, *d, src, dst;
+	int left, i, m, n = 0;
+	bool sapt, dapt;
+
+	left = (gX & 0x8000) ? 0x10000 - gX : 0;
+	while ((left > 1) && (n < FUSE_LOOP_MAX)) {
+		src = fuse_ea(instr[0],p,&sapt);
+		dst = fuse_ea(instr[1],p + 1,&dapt);
+		spage = MemoryPage(src >> 10,sapt,false);
+		if (!spage)
+			break;
+		dpage = MemoryPage(dst >> 10,dapt,true);
+		if (!dpage)
+			break;
+		m = left - 1;
+		if (m > fuse_pageleft(src)) m = fuse_pageleft(src);
+		if (m > fuse_pageleft(dst)) m = fuse_pageleft(dst);
+		if (m > FUSE_LOOP_MAX - n) m = FUSE_LOOP_MAX - n;
+		s = &spage[src & 01777];
+		d = &dpage[dst & 01777];
+		if ((d > s) && (d < s + m)) {
+			for (i = 0; i < m; i++)
+				d[i] = s[i];
+		} else
+			memmove(d,s,m * sizeof(ushort));
+		HEAT_N(HM_READ,spage - VolatileMemory->n_Array,m);	/* as many as word by word */
+		HEAT_N(HM_WRITE,dpage - VolatileMemory->n_Array,m);
+		gA = d[m - 1];
+		gX += m;
+		left -= m;
+		n += m;
+	}
+	if (!n)
+		return(fuse_step(instr,4));
+	gPC = do_add(p + 3,FUSE_DISP(instr[3]),0);
+	return(4 * n);
+}
+
+/*
+ * Is instruction i in block b the standard handler in funcs[] for an
+ * X indexed memory reference, d,X or d,B,X.
+ */
+static bool fuse_xmemref(struct BlockEntry *b, int i, void (**funcs)(ushort)) {
+	ushort instr = b->instr[i];
+	ushort mode = (instr >> 8) & 0x07;
+	return(((mode == 4) || (mode == 5)) && (b->func[i] == funcs[mode]));
+}
+
+/*
+ * Is instruction i in block b the AAX 1 / JXN back to i - back pair
+ * closing a loop.
+ */
+static bool fuse_looptail(struct BlockEntry *b, int i, int back) {
+	return((i + 1 < b->len) &&
+	       (b->func[i] == &ndfunc_aax) && (b->instr[i] == 0173401) &&
+	       (b->func[i + 1] == &ndfunc_jxn) && (FUSE_DISP(b->instr[i + 1]) == (ushort)-(back + 1)));
+}
+
+/*
+ * Is instruction i in block b the standard handler in funcs[] for a
+ * direct mode memory reference.
+ */
+static bool fuse_memref(struct BlockEntry *b, int i, void (**funcs)(ushort)) {
+	ushort instr = b->instr[i];
+	return(FUSE_DIRECT(instr) && (b->func[i] == funcs[(instr >> 8) & 0x07]));
+}
+
+/*
+ * Replace known instruction sequences in block b with superinstructions.
+ */
+void BlockFuse(struct BlockEntry *b) {
+	int i, w;
+
+	for (i = 0; i < b->len; i += w) {
+		w = 1;
+		if (fuse_xmemref(b,i,ndfunc_stz_mode) && fuse_looptail(b,i + 1,1)) {
+			b->fused[i] = &fuse_clear_loop;
+			w = 3;
+		} else if ((i + 1 < b->len) && fuse_xmemref(b,i,ndfunc_lda_mode) &&
+			   fuse_xmemref(b,i + 1,ndfunc_sta_mode) && fuse_looptail(b,i + 2,2)) {
+			b->fused[i] = &fuse_copy_loop;
+			w = 4;
+		} else if ((i + 2 < b->len) && fuse_memref(b,i,ndfunc_lda_mode) &&
+		    fuse_memref(b,i + 1,ndfunc_add_mode) && fuse_memref(b,i + 2,ndfunc_sta_mode)) {
+			b->fused[i] = &fuse_lda_add_sta;
+			w = 3;
+		} else if (i + 1 < b->len) {
+			if (fuse_memref(b,i,ndfunc_ldx_mode) && (b->func[i + 1] == &ndfunc_jxz)) {
+				b->fused[i] = &fuse_ldx_jxz;
+				w = 2;
+			} else if (FuseExtend(b->instr[i],b->instr[i + 1])) {
+				b->fused[i] = &fuse_skp_jmp;
+				w = 2;
+			} else if ((b->func[i] == &ndfunc_aax) && (b->func[i + 1] == &ndfunc_jxn)) {
+				b->fused[i] = &fuse_aax_jxn;
+				w = 2;
+			}
+		}
+		b->width[i] = w;
+	}
+}
+
+/*
+ * Should a block ending with instruction last also take in next.
+ * True for a skip followed by a jump, which BlockFuse can make one.
+ */
+bool FuseExtend(ushort last, ushort next) {
+	return(FUSION && (INSTR_FUNC(last) == &ndfunc_skp) &&
+	       (INSTR_FUNC(next) == ndfunc_jmp_mode[(next >> 8) & 0x07]));
+}
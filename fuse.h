@@ -0,0 +1,51 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Superinstructions for the block cache, see BlockFuse in fuse.c
+ */
+
+/* Config switch, instruction fusion on or off */
+int FUSION = 1;
+
+extern struct CpuRegs *gReg;
+extern _NDRAM_ *VolatileMemory;
+extern volatile int bc_break;
+extern unsigned long long *hm_count;
+extern int HEATMAP_LEVELS;
+
+extern void (*ndfunc_stz_mode[8])(ushort);
+extern void (*ndfunc_sta_mode[8])(ushort);
+extern void (*ndfunc_lda_mode[8])(ushort);
+extern void (*ndfunc_ldx_mode[8])(ushort);
+extern void (*ndfunc_add_mode[8])(ushort);
+extern void (*ndfunc_jmp_mode[8])(ushort);
+extern void ndfunc_aax(ushort operand);
+extern void ndfunc_jxz(ushort operand);
+extern void ndfunc_jxn(ushort operand);
+extern void ndfunc_skp(ushort operand);
+
+extern ushort do_add(ushort a, ushort b, ushort k);
+extern bool IsSkip(ushort instr);
+extern ushort *MemoryPage(ushort vpn, bool UseAPT, bool write);
+
+void BlockFuse(struct BlockEntry *b);
+bool FuseExtend(ushort last, ushort next);
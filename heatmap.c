@@ -0,0 +1,115 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Memory access counts per physical page.
+ *
+ * Counts reads, writes and fetches for each physical 1K page, and if
+ * "heatmap_levels" is set, for each interrupt level as well, to show
+ * which memory the guest actually works in. Only built with -DHEATMAP
+ * (see the Makefile), without it the counting is not in the code at all.
+ * With it, but no "heatmap" file set, it is one test per access.
+ *
+ * The counts go to the file at exit, and on a SIGUSR1 while running,
+ * the file being rewritten each time. As CSV, one line per page that has
+ * been touched (level -1 when not counted per level), or with
+ * "heatmap_format" set to "binary", a short header
+ * followed by all the counters:
+ *
+ *	char magic[4]		"NDHM"
+ *	uint32 levels		1, or 16 with heatmap_levels
+ *	uint32 pages		pages per level
+ *	uint32 kinds		counters per page, read, write, fetch
+ *	uint64 count[levels][pages][kinds]
+ *
+ * all in host byte order. Physical accesses (LDATX, STATX, EXAM, DEPO,
+ * MOVEW and so on) and moves a page at a time are counted like the same
+ * accesses one by one, as are the ones done by fused instructions, and code
+ * run from the block cache is counted as fetched. Only the loads and
+ * stores done by jit and hle native code are not counted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "nd100.h"
+#include "heatmap.h"
+
+/*
+ * Setup_Heatmap - Get the counters if a heatmap file is set.
+ */
+void Setup_Heatmap(void) {
+	size_t n;
+
+	if (!HEATMAP_FILE)
+		return;
+#ifndef HEATMAP
+	fprintf(stderr,"heatmap set, but nd100em is built without -DHEATMAP, not counting\n");
+	return;
+#endif
+	n = (size_t)((HEATMAP_LEVELS) ? 16 : 1) * MEMPTSIZE * HM_KINDS;
+	hm_count = calloc(n,sizeof(unsigned long long));
+	if (!hm_count)
+		fprintf(stderr,"No memory for heatmap counters, not counting\n");
+}
+
+/*
+ * HeatmapDump - Write the counters to the heatmap file.
+ * Called from the cpu thread only, so the counts are not moving.
+ */
+void HeatmapDump(void) {
+	FILE *f;
+	uint32_t hdr[3];
+	int levels, lvl, page;
+	unsigned long long *c;
+
+	if (!hm_count)
+		return;
+	levels = (HEATMAP_LEVELS) ? 16 : 1;
+	f = fopen(HEATMAP_FILE,(HEATMAP_BINARY) ? "wb" : "w");
+	if (!f) {
+		fprintf(stderr,"Can not write heatmap file %s\n",HEATMAP_FILE);
+		return;
+	}
+	if (HEATMAP_BINARY) {
+		hdr[0] = levels;
+		hdr[1] = MEMPTSIZE;
+		hdr[2] = HM_KINDS;
+		fwrite("NDHM",1,4,f);
+		fwrite(hdr,sizeof(hdr),1,f);
+		fwrite(hm_count,sizeof(unsigned long long),(size_t)levels * MEMPTSIZE * HM_KINDS,f);
+	} else {
+		fprintf(f,"page,level,read,write,fetch\n");
+		for (lvl=0;lvl<levels;lvl++) {
+			for (page=0;page<MEMPTSIZE;page++) {
+				c = &hm_count[((lvl * MEMPTSIZE) + page) * HM_KINDS];
+				if (c[HM_READ] | c[HM_WRITE] | c[HM_FETCH])
+					fprintf(f,"%d,%d,%llu,%llu,%llu\n",page,(HEATMAP_LEVELS) ? lvl : -1,
+						c[HM_READ],c[HM_WRITE],c[HM_FETCH]);
+			}
+		}
+	}
+	if (fclose(f))
+		fprintf(stderr,"Error writing heatmap file %s\n",HEATMAP_FILE);
+	if (debug) fprintf(debugfile,"Heatmap written to %s\n",HEATMAP_FILE);
+}
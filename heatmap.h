@@ -0,0 +1,40 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+
+/*
+ * Memory access counts per physical page, see heatmap.c
+ */
+
+/* Config, set from "heatmap", "heatmap_format" and "heatmap_levels" in nd100em.conf */
+char *HEATMAP_FILE = NULL;
+int HEATMAP_BINARY = 0;
+int HEATMAP_LEVELS = 0;
+
+/* Counters, NULL when not in use */
+unsigned long long *hm_count = NULL;
+
+extern int debug;
+extern FILE *debugfile;
+
+void Setup_Heatmap(void);
+void HeatmapDump(void);
@@ -0,0 +1,208 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * High level emulation of known guest routines.
+ *
+ * Some small library routines spend nearly all their time in a tight
+ * loop. The routines below are recognized by their exact code when a
+ * block is built at their entry point, and the block then runs a native
+ * version of the loop instead, with the same effect on registers, memory,
+ * STS and the page table PGU bits as running the guest code. The guest
+ * needs no changes, the native version is only used where the code is
+ * there word for word.
+ *
+ * Which routines to look for is set with "hle" in nd100em.conf. The code
+ * is compared again every time the routine is entered, and any write to
+ * it also drops the block through the normal block cache checks, so a
+ * routine that is patched or overwritten is simply run as guest code.
+ *
+ * The loops stop early, leaving P inside the routine, if an access would
+ * fault or hit shadow memory, so the fault is taken by the normal
+ * instruction handlers, and after HLE_LOOP_MAX rounds so interrupts are
+ * not held off. Only used with the block cache.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "nd100.h"
+#include "hle.h"
+
+/* Loop rounds done natively per call */
+#define HLE_LOOP_MAX	1024
+
+/*
+ * CKSUM - add up the words from B-n to B-1, X = -n on entry
+ *	SAA 0
+ *	ADD 0,B,X
+ *	AAX 1
+ *	JXN *-2
+ *	EXIT
+ * Returns the sum in A, with X = 0.
+ */
+static int hle_cksum(void) {
+	ushort p = gPC;
+	ushort *page = NULL;
+	ushort vpn = 0, addr;
+	int n = 0;
+
+	gA = 0;
+	p++;
+	n++;
+	do {
+		addr = gB + gX;
+		if (!page || ((addr >> 10) != vpn)) {
+			vpn = addr >> 10;
+			page = MemoryPage(vpn,true,false);
+			if (!page)
+				break;
+		}
+		gA = do_add(gA,page[addr & 01777],0);
+		gX = do_add(gX,1,0);
+		n += 3;
+		if (!(gX & (1<<15))) {
+			p += 3;		/* loop done, on to EXIT */
+			break;
+		}
+		do_add(p + 2,(ushort)-2,0);	/* the JXN back, for its flags */
+	} while (n < 3 * HLE_LOOP_MAX);
+	gPC = p;
+	return(n);
+}
+
+/*
+ * WSRCH - look for the word in A among the words from B-n to B-1,
+ * X = -n on entry
+ *	LDT 0,B,X
+ *	SKP IF T UEQ A
+ *	EXIT
+ *	AAX 1
+ *	JXN *-4
+ *	EXIT
+ * Returns from the first EXIT with B+X the address of the match, or from
+ * the second with X = 0 if there is none.
+ */
+static int hle_wsrch(void) {
+	ushort p = gPC;
+	ushort *page = NULL;
+	ushort vpn = 0, addr;
+	int n = 0;
+
+	do {
+		addr = gB + gX;
+		if (!page || ((addr >> 10) != vpn)) {
+			vpn = addr >> 10;
+			page = MemoryPage(vpn,true,false);
+			if (!page)
+				break;
+		}
+		gT = page[addr & 01777];
+		if (gT == gA) {
+			p += 2;		/* found, on to the first EXIT */
+			n += 2;
+			break;
+		}
+		gX = do_add(gX,1,0);
+		n += 4;
+		if (!(gX & (1<<15))) {
+			p += 5;		/* not found, on to the second EXIT */
+			break;
+		}
+		do_add(p + 4,(ushort)-4,0);	/* the JXN back, for its flags */
+	} while (n < 4 * HLE_LOOP_MAX);
+	gPC = p;
+	return(n);
+}
+
+static const struct HleRoutine hle_routines[] = {
+	{ "cksum", 5, { 0170400, 0062400, 0173401, 0133776, 0146142 }, &hle_cksum },
+	{ "wsrch", 6, { 0052400, 0142056, 0146142, 0173401, 0133774, 0146142 }, &hle_wsrch },
+};
+
+#define HLE_NROUTINES	(sizeof(hle_routines) / sizeof(hle_routines[0]))
+
+/* The routines enabled in nd100em.conf */
+static const struct HleRoutine *hle_active[HLE_MAX];
+static int hle_nactive = 0;
+
+/* First words of the active routines, so most blocks are passed over at once */
+static unsigned char hle_first[65536/8];
+
+/*
+ * Set up the routines named in HLE_NAMES.
+ */
+void Setup_HLE(void) {
+	int i, j;
+
+	hle_nactive = 0;
+	memset(hle_first,0,sizeof(hle_first));
+	for (i=0;i<HLE_COUNT;i++) {
+		for (j=0;j<HLE_NROUTINES;j++)
+			if (strcmp(HLE_NAMES[i],hle_routines[j].name) == 0)
+				break;
+		if (j == HLE_NROUTINES) {
+			fprintf(stderr,"Unknown hle routine %s\n",HLE_NAMES[i]);
+			continue;
+		}
+		hle_active[hle_nactive++] = &hle_routines[j];
+		hle_first[hle_routines[j].code[0] >> 3] |= 1 << (hle_routines[j].code[0] & 7);
+	}
+}
+
+/*
+ * Is the code at physical address paddr one of the active routines.
+ * The whole routine has to be inside one page, like a block.
+ */
+struct HleRoutine *HleFind(ulong paddr) {
+	ushort first = VolatileMemory->n_Array[paddr];
+	int i, len;
+
+	if (!(hle_first[first >> 3] & (1 << (first & 7))))
+		return(NULL);
+	for (i=0;i<hle_nactive;i++) {
+		len = hle_active[i]->len;
+		if (((paddr & 01777) + len <= 1024) &&
+		    (memcmp(&VolatileMemory->n_Array[paddr],hle_active[i]->code,len * sizeof(ushort)) == 0)) {
+			if (debug)
+				fprintf(debugfile,"hle: %s at %lo\n",hle_active[i]->name,paddr);
+			return((struct HleRoutine *)hle_active[i]);
+		}
+	}
+	return(NULL);
+}
+
+/*
+ * Run the routine of block b, P is at its entry.
+ * Returns the number of instructions done, 0 if the interpreter has to
+ * run the instruction at P, as when the code is no longer the same.
+ */
+int HleRun(struct BlockEntry *b) {
+	const struct HleRoutine *r = b->hle;
+
+	if (memcmp(&VolatileMemory->n_Array[b->paddr],r->code,r->len * sizeof(ushort)) != 0) {
+		b->len = 0;	/* changed behind our back, build the block again */
+		return(0);
+	}
+	return(r->native());
+}
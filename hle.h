@@ -0,0 +1,41 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * High level emulation of known guest routines, see hle.c
+ */
+
+/* Config, routines to replace, set from "hle" in nd100em.conf */
+char *HLE_NAMES[HLE_MAX];
+int HLE_COUNT = 0;
+
+extern struct CpuRegs *gReg;
+extern _NDRAM_ *VolatileMemory;
+extern int debug;
+extern FILE *debugfile;
+
+void Setup_HLE(void);
+struct HleRoutine *HleFind(ulong paddr);
+int HleRun(struct BlockEntry *b);
+
+extern ushort do_add(ushort a, ushort b, ushort k);
+extern ushort *MemoryPage(ushort vpn, bool UseAPT, bool write);
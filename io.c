@@ -1024,8 +1024,8 @@ void panel_thread() {
 				while ((s = sem_wait(&sem_stop)) == -1 && errno == EINTR) /* wait for stop lock to be free and take it */
 					continue; /* Restart if interrupted by handler */
 				bzero(gReg,sizeof(struct CpuRegs));	/* clear cpu */
-				setbit(_STS,_O,1);
 				setbit_STS_MSB(_N100,1);
+				setbit(_STS,_O,1);
 				gCSR = 1<<2;    /* this bit sets the cache as not available */
 
 			} else if(strncmp("LOAD_PRESSED\n",recv_data,strlen("LOAD_PRESSED"))==0){
@@ -1042,6 +1042,11 @@ void panel_thread() {
 				/* NOTE:: buggy in that we cannot do STOP and MCL without a running cpu between.. FIXME */
 				while ((s = sem_wait(&sem_stop)) == -1 && errno == EINTR) /* wait for stop lock to be free and take it */
 					continue; /* Restart if interrupted by handler */
+			} else if(strncmp("TRACE=",recv_data,strlen("TRACE="))==0){
+				/* Same bits as trace in nd100em.conf, the cpu picks the right loop by itself */
+				if (debug) fprintf(debugfile,"(#)TRACE=%d\n",atoi(&recv_data[strlen("TRACE=")]));
+				if (!tracefile) trace_open();
+				trace = atoi(&recv_data[strlen("TRACE=")]);
 			} else {
 				if (debug) fprintf(debugfile,"(#)Panel received:%s\n",recv_data);
 			}
@@ -24,6 +24,7 @@
 
 extern int trace;
 extern FILE *tracefile;
+extern int trace_open();
 extern int debug;
 extern FILE *debugfile;
 
@@ -0,0 +1,337 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * A simple template JIT on top of the block cache.
+ *
+ * Blocks run JIT_THRESHOLD times get translated to x86-64 code. Each
+ * instruction either gets an inline template or becomes a direct call to
+ * its handler in instr_funcs, so anything not translated falls back to the
+ * interpreter code for that instruction. After each instruction the same
+ * checks as in BlockRun are done, so a translated block stops at exactly
+ * the same place as an interpreted one.
+ *
+ * Register use in translated code:
+ *	rbx	current level register bank, gReg->myreg_CUR
+ *	r12d	P at block entry
+ *	r13	VolatileMemory->n_Array
+ *	r14	&bc_break
+ *	r15d	nonzero if memory can be accessed directly (paging off)
+ *	rbp	bc_pagemap
+ * Guest registers are used straight from the bank as memory operands.
+ *
+ * Memory templates handle the direct (paging off) case inline and call
+ * the instruction handler for anything needing a page table lookup, shadow
+ * memory or a write to a page holding cached code.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "nd100.h"
+#include "jit.h"
+
+#if defined(__x86_64__)
+
+static unsigned char *jit_buf = NULL;	/* Code buffer */
+static size_t jit_used;			/* Bytes used in it */
+static unsigned char *jp;		/* Emit pointer */
+static bool jit_broken = false;		/* Could not get a code buffer */
+
+#define REGOFF(r)	((r)*2)		/* Offset of a register in the bank */
+
+static void e8(int v) { *jp++ = (unsigned char)v; }
+static void e32(unsigned int v) { memcpy(jp,&v,4); jp += 4; }
+static void e64(unsigned long v) { memcpy(jp,&v,8); jp += 8; }
+
+/* Emit a jcc/jmp with a rel32 to be patched, returns where the rel32 is */
+static unsigned char *ejump(int cc) {
+	unsigned char *at;
+	if (cc < 0) {
+		e8(0xE9);			/* jmp rel32 */
+	} else {
+		e8(0x0F); e8(0x80 | cc);	/* jcc rel32 */
+	}
+	at = jp;
+	e32(0);
+	return(at);
+}
+
+static void patch(unsigned char *at, unsigned char *to) {
+	int rel = (int)(to - (at + 4));
+	memcpy(at,&rel,4);
+}
+
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define JMP	-1
+
+/* movzx reg32, word [rbx+REGOFF(r)], reg = 0 eax, 1 ecx, 2 edx, 6 esi, 7 edi */
+static void eload(int reg, int r) {
+	e8(0x0F); e8(0xB7); e8(0x43 | (reg << 3)); e8(REGOFF(r));
+}
+
+/* mov word [rbx+REGOFF(r)], reg16 */
+static void estore(int reg, int r) {
+	e8(0x66); e8(0x89); e8(0x43 | (reg << 3)); e8(REGOFF(r));
+}
+
+/* Call handler func with the instruction word as argument */
+static void ecall(void (*func)(ushort), ushort instr) {
+	e8(0xBF); e32(instr);				/* mov edi, instr */
+	e8(0x48); e8(0xB8); e64((unsigned long)func);	/* mov rax, func */
+	e8(0xFF); e8(0xD0);				/* call rax */
+}
+
+/*
+ * Effective address of a memory reference instruction into eax,
+ * for the modes we handle inline (P, B, X, B+X relative).
+ * Jumps to the returned fixup list if memory must go the slow way.
+ */
+static bool eea(ushort instr, unsigned char **slow1, unsigned char **slow2) {
+	int disp = (signed char)(instr & 0xff);
+	switch ((instr >> 8) & 0x07) {
+	case 0:	eload(0,_P); break;
+	case 1:	eload(0,_B); break;
+	case 4:	eload(0,_X); break;
+	case 5:	eload(0,_B); eload(1,_X); e8(0x01); e8(0xC8); break;	/* add eax, ecx */
+	default:
+		return(false);
+	}
+	e8(0x05); e32(disp);			/* add eax, disp */
+	e8(0x0F); e8(0xB7); e8(0xC0);		/* movzx eax, ax */
+	e8(0x45); e8(0x85); e8(0xFF);		/* test r15d, r15d */
+	*slow1 = ejump(CC_E);
+	e8(0x3D); e32(0177000);			/* cmp eax, 0177000 (possible shadow memory) */
+	*slow2 = ejump(CC_AE);
+	return(true);
+}
+
+/*
+ * Inline template for one instruction. Returns false if there is none,
+ * and the handler has to be called instead.
+ */
+static bool etemplate(ushort instr, void (*func)(ushort)) {
+	unsigned char *slow1, *slow2, *slow3 = NULL, *done;
+	int dr, sr, rop, m = (instr >> 8) & 0x07;
+
+	if (func == regop_funcs[instr & 03777]) {
+		sr = (instr >> 3) & 0x07;
+		dr = instr & 0x07;
+		if (!sr || !dr || (dr == _P))
+			return(false);
+		rop = (instr >> 6) & 0x1f;	/* RAD, 2 op bits, CM1, CLD */
+		switch (rop & 0x1c) {
+		case 0x00: /* SWAP */
+			if (sr == _P)
+				return(false);		/* handler counts up P before writing it */
+			eload(1,dr);				/* ecx = (dr) */
+			eload(0,sr);
+			if (rop & 0x02) { e8(0xF7); e8(0xD0); }	/* not eax */
+			estore(0,dr);
+			if (rop & 0x01) {
+				e8(0x66); e8(0xC7); e8(0x43); e8(REGOFF(sr)); e8(0); e8(0);	/* mov word [sr], 0 */
+			} else
+				estore(1,sr);
+			break;
+		case 0x04: /* RAND */
+		case 0x08: /* REXO */
+		case 0x0c: /* RORA */
+			eload(0,sr);
+			if (rop & 0x02) { e8(0xF7); e8(0xD0); }	/* not eax */
+			if ((rop & 0x1c) == 0x04) {
+				if (rop & 0x01) {
+					e8(0x31); e8(0xC0);	/* xor eax, eax */
+				} else {
+					eload(1,dr);
+					e8(0x21); e8(0xC8);	/* and eax, ecx */
+				}
+			} else if (!(rop & 0x01)) {
+				eload(1,dr);
+				if ((rop & 0x1c) == 0x08) {
+					e8(0x31); e8(0xC8);	/* xor eax, ecx */
+				} else {
+					e8(0x09); e8(0xC8);	/* or eax, ecx */
+				}
+			}
+			estore(0,dr);
+			break;
+		case 0x10: /* RADD, COPY/COMM when CLD */
+			if (!(rop & 0x01))
+				return(false);		/* sets flags, use handler */
+			eload(0,sr);
+			if (rop & 0x02) { e8(0xF7); e8(0xD0); }	/* not eax */
+			estore(0,dr);
+			break;
+		case 0x1c: /* NOOP */
+			break;
+		default:
+			return(false);
+		}
+		e8(0x66); e8(0xFF); e8(0x43); e8(REGOFF(_P));	/* inc word [P] */
+		return(true);
+	}
+
+	if ((func != ndfunc_lda_mode[m]) && (func != ndfunc_ldt_mode[m]) && (func != ndfunc_ldx_mode[m]) &&
+	    (func != ndfunc_sta_mode[m]) && (func != ndfunc_stt_mode[m]) && (func != ndfunc_stx_mode[m]) &&
+	    (func != ndfunc_stz_mode[m]) && (func != ndfunc_add_mode[m]))
+		return(false);
+	if (!eea(instr,&slow1,&slow2))
+		return(false);
+
+	if ((func == ndfunc_lda_mode[m]) || (func == ndfunc_ldt_mode[m]) || (func == ndfunc_ldx_mode[m])) {
+		e8(0x41); e8(0x0F); e8(0xB7); e8(0x4C); e8(0x45); e8(0x00);	/* movzx ecx, word [r13+rax*2] */
+		estore(1,(func == ndfunc_lda_mode[m]) ? _A : (func == ndfunc_ldt_mode[m]) ? _T : _X);
+	} else if (func == ndfunc_add_mode[m]) {
+		e8(0x41); e8(0x0F); e8(0xB7); e8(0x74); e8(0x45); e8(0x00);	/* movzx esi, word [r13+rax*2] */
+		eload(7,_A);							/* edi = A */
+		e8(0x31); e8(0xD2);						/* xor edx, edx */
+		e8(0x48); e8(0xB8); e64((unsigned long)&do_add);		/* mov rax, do_add */
+		e8(0xFF); e8(0xD0);						/* call rax */
+		estore(0,_A);
+	} else {
+		/* A write to a page with cached code has to go through MemoryWrite */
+		e8(0x89); e8(0xC2);					/* mov edx, eax */
+		e8(0xC1); e8(0xEA); e8(10);				/* shr edx, 10 */
+		e8(0x80); e8(0x7C); e8(0x15); e8(0x00); e8(0x00);	/* cmp byte [rbp+rdx], 0 */
+		slow3 = ejump(CC_NE);
+		if (func == ndfunc_stz_mode[m]) {
+			e8(0x31); e8(0xC9);				/* xor ecx, ecx */
+		} else
+			eload(1,(func == ndfunc_sta_mode[m]) ? _A : (func == ndfunc_stt_mode[m]) ? _T : _X);
+		e8(0x66); e8(0x41); e8(0x89); e8(0x4C); e8(0x45); e8(0x00);	/* mov word [r13+rax*2], cx */
+	}
+	e8(0x66); e8(0xFF); e8(0x43); e8(REGOFF(_P));		/* inc word [P] */
+	done = ejump(JMP);
+
+	patch(slow1,jp);
+	patch(slow2,jp);
+	if (slow3)
+		patch(slow3,jp);
+	ecall(func,instr);
+	patch(done,jp);
+	return(true);
+}
+
+/*
+ * Translate block b. On success b->native is set.
+ */
+bool JitCompile(struct BlockEntry *b) {
+	unsigned char *start, *exits[BC_MAXLEN + 1][2], *epi[BC_MAXLEN + 1];
+	int i;
+
+	if (jit_broken)
+		return(false);
+	if (!jit_buf) {
+		jit_buf = mmap(NULL,JIT_CODESIZE,PROT_READ | PROT_WRITE | PROT_EXEC,
+			MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+		if (jit_buf == MAP_FAILED) {
+			jit_buf = NULL;
+			jit_broken = true;
+			return(false);
+		}
+		jit_used = 0;
+	}
+	/* Worst case is a bit over 100 bytes per instruction */
+	if (jit_used + 256 * (BC_MAXLEN + 1) > JIT_CODESIZE)
+		JitFlush();
+
+	start = jp = jit_buf + jit_used;
+
+	/* Prologue */
+	e8(0x53);				/* push rbx */
+	e8(0x55);				/* push rbp */
+	e8(0x41); e8(0x54);			/* push r12 */
+	e8(0x41); e8(0x55);			/* push r13 */
+	e8(0x41); e8(0x56);			/* push r14 */
+	e8(0x41); e8(0x57);			/* push r15 */
+	e8(0x48); e8(0x83); e8(0xEC); e8(8);	/* sub rsp, 8 */
+	e8(0x48); e8(0x89); e8(0xFB);		/* mov rbx, rdi */
+	e8(0x41); e8(0x89); e8(0xF7);		/* mov r15d, esi */
+	e8(0x44); e8(0x0F); e8(0xB7); e8(0x63); e8(REGOFF(_P));	/* movzx r12d, word [P] */
+	e8(0x49); e8(0xBD); e64((unsigned long)VolatileMemory->n_Array);	/* mov r13, memory */
+	e8(0x49); e8(0xBE); e64((unsigned long)&bc_break);		/* mov r14, &bc_break */
+	e8(0x48); e8(0xBD); e64((unsigned long)bc_pagemap);		/* mov rbp, bc_pagemap */
+
+	for (i = 0; i < b->len; i++) {
+		if (!etemplate(b->instr[i],b->func[i]))
+			ecall(b->func[i],b->instr[i]);
+		/* Same checks as BlockRun: stop on break, or if P did not just count up */
+		e8(0x41); e8(0x83); e8(0x3E); e8(0x00);			/* cmp dword [r14], 0 */
+		exits[i + 1][0] = ejump(CC_NE);
+		eload(0,_P);
+		e8(0x41); e8(0x8D); e8(0x8C); e8(0x24); e32(i + 1);	/* lea ecx, [r12 + i+1] */
+		e8(0x66); e8(0x39); e8(0xC8);				/* cmp ax, cx */
+		exits[i + 1][1] = ejump(CC_NE);
+	}
+
+	/* Exits, eax = number of instructions executed */
+	e8(0xB8); e32(b->len);			/* mov eax, len */
+	epi[0] = ejump(JMP);
+	for (i = 1; i <= b->len; i++) {
+		patch(exits[i][0],jp);
+		patch(exits[i][1],jp);
+		e8(0xB8); e32(i);			/* mov eax, i */
+		epi[i] = ejump(JMP);
+	}
+	for (i = 0; i <= b->len; i++)
+		patch(epi[i],jp);
+
+	/* Epilogue */
+	e8(0x48); e8(0x83); e8(0xC4); e8(8);	/* add rsp, 8 */
+	e8(0x41); e8(0x5F);			/* pop r15 */
+	e8(0x41); e8(0x5E);			/* pop r14 */
+	e8(0x41); e8(0x5D);			/* pop r13 */
+	e8(0x41); e8(0x5C);			/* pop r12 */
+	e8(0x5D);				/* pop rbp */
+	e8(0x5B);				/* pop rbx */
+	e8(0xC3);				/* ret */
+
+	jit_used = jp - jit_buf;
+	b->native = (int (*)(ushort *, int))start;
+	return(true);
+}
+
+/*
+ * Drop all translations and start over with an empty code buffer.
+ */
+void JitFlush() {
+	int i;
+	for (i = 0; i < BC_SIZE; i++) {
+		bc_table[i].native = NULL;
+		bc_table[i].hits = 0;
+	}
+	jit_used = 0;
+}
+
+#else	/* !__x86_64__ */
+
+bool JitCompile(struct BlockEntry *b) {
+	return(false);
+}
+
+void JitFlush() {
+}
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Template JIT for hot blocks from the block cache (x86-64 hosts only).
+ */
+
+#define JIT_CODESIZE	(8*1024*1024)	/* Size of the native code buffer */
+
+/* Config switch, JIT on or off */
+int JIT = 0;
+
+extern struct BlockEntry bc_table[];
+extern volatile int bc_break;
+extern unsigned char bc_pagemap[];
+extern _NDRAM_ *VolatileMemory;
+
+bool JitCompile(struct BlockEntry *b);
+void JitFlush(void);
+
+extern void (*ndfunc_stz_mode[8])(ushort);
+extern void (*ndfunc_sta_mode[8])(ushort);
+extern void (*ndfunc_stt_mode[8])(ushort);
+extern void (*ndfunc_stx_mode[8])(ushort);
+extern void (*ndfunc_lda_mode[8])(ushort);
+extern void (*ndfunc_ldt_mode[8])(ushort);
+extern void (*ndfunc_ldx_mode[8])(ushort);
+extern void (*ndfunc_add_mode[8])(ushort);
+extern void (*regop_funcs[2048])(ushort);
+extern ushort do_add(ushort a, ushort b, ushort k);
@@ -78,7 +78,7 @@ void mon_1(){
 	if  (trace & 0x01) fprintf(tracefile,
 		"#o (i,d) #v# (\"%d\",\"MONINPT: %c\");\n",
 		(int)instr_counter,(gA&0x007F));
-	gReg->reg[CurrLEVEL][_P]++;  // IF ERROR RETURN DONT COUNT UP
+	gReg->myreg_CUR[_P]++;  // IF ERROR RETURN DONT COUNT UP
 }
 
 void mon_2(){ /* MON 2 OUTBT  T=Filenumber; A=Byte;  Ret A=errorcode */
@@ -98,7 +98,7 @@ void mon_2(){ /* MON 2 OUTBT  T=Filenumber; A=Byte;  Ret A=errorcode */
 			"#o (i,d) #v# (\"%d\",\"MONOUTBT: (decimal=%d) T=%06o A=%06o\");\n",
 			(int)instr_counter,ch,gT,gA);
 	}
-	gReg->reg[CurrLEVEL][_P]++;  // IF ERROR RETURN DONT COUNT UP
+	gReg->myreg_CUR[_P]++;  // IF ERROR RETURN DONT COUNT UP
 }
 
 void mon_3(){
@@ -106,6 +106,8 @@
 #define _PONI 14
 #define _IONI 15
 
+#define STS_LAZY ((1<<_Q)|(1<<_O)|(1<<_C))	/* set lazily by do_add, see SyncSTS */
+
 
 typedef unsigned short int ushort;
 typedef signed short int sshort;
@@ -122,8 +124,14 @@ typedef signed long int slong;
 /* Lets use the full 16MWord space now (32MB ram in host)*/
 #define MEMPTSIZE 16384
 
+/* Huge page size of the host, for guest memory on huge pages */
+#define HUGEPAGE_SIZE	(2*1024*1024)
+
 /* Volatile Memory
- * Fixed to MEMPTSIZE KWords for now.
+ * Always MEMPTSIZE KWords of address space. Only what is touched is
+ * committed, see setup_memory. ND_Memsize words of it is the guest memory,
+ * physical addresses are masked to it and page numbers past it give
+ * memory out of range.
  */
 typedef union ndram {
 	unsigned char	c_Array[MEMPTSIZE*1024*2];
@@ -144,6 +152,47 @@ union NewPT {
 	ulong	pt[4][64];
 };
 
+/*
+ * PGU and WIP set by memory accesses, bit vpn for page vpn of each page
+ * table. Kept apart from the page tables so an access only writes here
+ * when the bit is not set yet. An entry's real PGU and WIP are these or'ed
+ * with its own, see PageBitsSync.
+ */
+struct PageBits {
+	unsigned long long	used[4];	/* PGU */
+	unsigned long long	written[4];	/* WIP */
+};
+
+/*
+ * Start of the POSIX shared memory object set with "shm" in nd100em.conf,
+ * see setup_shm. Offsets are from the start of the object, sizes in bytes.
+ * The registers, page tables and guest memory are the ones the emulator
+ * runs on, so a program mapping the object read only sees the machine as
+ * it runs, without any locking. PGU and WIP set since an entry was last
+ * read or written by the guest are only in the struct PageBits, or them
+ * into the entry to get what the guest would see.
+ *
+ * The object is only readable by the emulator's user, or its group too
+ * with "shm_mode", so tools have to run as one of those.
+ */
+#define SHM_MAGIC	"ND100EM"
+#define SHM_VERSION	2
+struct ShmHeader {
+	char	magic[8];		/* SHM_MAGIC, written last */
+	unsigned int	version;	/* SHM_VERSION */
+	unsigned int	hdr_size;	/* sizeof(struct ShmHeader) */
+	unsigned int	pid;		/* of the emulator */
+	unsigned int	memsize;	/* guest memory in words, ND_Memsize */
+	unsigned long long	regs_off, regs_size;	/* struct CpuRegs */
+	unsigned long long	pt_off, pt_size;	/* union NewPT */
+	unsigned long long	bits_off, bits_size;	/* struct PageBits */
+	unsigned long long	mem_off, mem_size;	/* _NDRAM_ */
+	/* Set every rtc tick (20 ms), generation last */
+	volatile unsigned long long	instructions;	/* instructions run */
+	volatile int	runmode;	/* _RUNMODE_ */
+	volatile unsigned long long	generation;
+};
+
 struct CpuRegs {
 	ushort	reg[16][16];	/* main CPU registers for all runlevels */
 	ushort	reg_PANS;	/* */
@@ -174,6 +223,20 @@ struct CpuRegs {
 	/* Personally Added to do Prefetch and Instruction more alike ND */
 	ushort	myreg_IR;	/* InstructionRegister */
 	ushort	myreg_PFB;	/* PrefetchBuffer */
+	ulong	myreg_PFA;	/* Physical address PFB was fetched from, ~0 if not from memory */
+
+	/* Shortcuts decoded from STS MSB, call CacheSTS() whenever reg[0][_STS] MSB changes */
+	/* or the PCR of the current level does */
+	ushort	*myreg_CUR;	/* reg[] of the current runlevel */
+	ushort	myreg_MSB;	/* STS MSB, the same on all levels */
+	void	(**myreg_DISP)(ushort);	/* dispatch table for the current ring */
+	struct TLB	*myreg_TLB;	/* TLB of the current level */
+
+	/* C, O and Q from do_add are kept here until SyncSTS puts them into STS */
+	int	lazy_res;	/* result of the last add, bit 16 is carry */
+	ushort	lazy_q;		/* bit 15 set if the last add overflowed */
+	ushort	lazy_o;		/* bit 15 set if any add overflowed since last sync */
+	bool	lazy_sts;	/* the above is not yet in STS */
 
 	/* "locks" for registers that according to manual works that way (PES, PGS, IIC) */
 	/* 1 = "locked" */
@@ -208,6 +271,55 @@ struct MemTraceList {
 	struct MemTraceList *next;
 };
 
+/*
+ * Predecoded basic block cache entry.
+ * A block is a run of instructions inside one physical page, stopped at the
+ * first instruction that may leave straight line execution or change the
+ * processor state the run depends on. It is keyed by the physical address of
+ * its first word, so every virtual mapping of a page shares the same blocks.
+ */
+#define BC_SIZE		4096	/* Number of block slots, direct mapped */
+#define BC_MAXLEN	16	/* Max instructions in one block */
+#define JIT_THRESHOLD	32	/* Block runs before the JIT translates it */
+#define FUSE_THRESHOLD	8	/* Block runs before superinstructions are made */
+
+#define BC_HASH(paddr)	(((paddr) ^ ((paddr) >> 12)) & (BC_SIZE - 1))
+
+/*
+ * Software TLB, one per level. Host address of the physical page each
+ * virtual page maps to, NULL if the access has to take the slow way
+ * through the page tables: not allowed, PGU (and WIP for write) not yet
+ * set, shadow memory, or simply not looked up yet. [0] is through PT,
+ * [1] through APT. See MemoryRead, and TlbFlush for when it is cleared.
+ */
+struct TLB {
+	ushort	*read[2][64];
+	ushort	*write[2][64];
+	ushort	*fetch[2][64];
+};
+
+/* A guest routine the block cache can run natively, see hle.c */
+struct HleRoutine {
+	const char	*name;		/* name in nd100em.conf */
+	int	len;			/* number of code words */
+	ushort	code[BC_MAXLEN];	/* the code to look for */
+	int	(*native)(void);	/* runs it, returns instructions done */
+};
+
+struct BlockEntry {
+	ulong	paddr;			/* physical address of first instruction */
+	unsigned int	gen;		/* page generation this block was built in */
+	int	len;			/* number of instructions, 0 = empty slot */
+	int	hits;			/* times run, for fusion and the JIT */
+	int	(*native)(ushort *regs, int fastmem);	/* JIT translation, if any */
+	ushort	instr[BC_MAXLEN];	/* the instruction words */
+	void	(*func[BC_MAXLEN])(ushort);	/* and their handlers */
+	void	(**disp)(ushort);	/* dispatch table func[] was taken from */
+	unsigned char	width[BC_MAXLEN];	/* words covered by the superinstruction here */
+	int	(*fused[BC_MAXLEN])(ushort *instr);	/* superinstruction, returns instructions done */
+	struct HleRoutine	*hle;	/* known routine run natively instead, see hle.c */
+};
+
 typedef enum {IGNORE, CANCEL, JOIN} _THREAD_KILL_MODE_;
 
 /*
@@ -240,13 +352,13 @@ typedef enum {SHUTDOWN, STOP, SEMIRUN, RUN} _RUNMODE_;
 
 typedef enum {ND1, ND4, ND10, ND100, ND100CE, ND100CX, ND110, ND110CE, ND110CX, ND110PCX} _CPUTYPE_;
 
-#define gPC	gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_P]
-#define gA	gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_A]
-#define gT	gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_T]
-#define gB	gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_B]
-#define gD	gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_D]
-#define gX	gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_X]
-#define gL	gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_L]
+#define gPC	gReg->myreg_CUR[_P]
+#define gA	gReg->myreg_CUR[_A]
+#define gT	gReg->myreg_CUR[_T]
+#define gB	gReg->myreg_CUR[_B]
+#define gD	gReg->myreg_CUR[_D]
+#define gX	gReg->myreg_CUR[_X]
+#define gL	gReg->myreg_CUR[_L]
 
 #define gPANC	gReg->reg_PANC
 #define gPANS	gReg->reg_PANS
@@ -272,31 +384,69 @@ typedef enum {ND1, ND4, ND10, ND100, ND100CE, ND100CX, ND110, ND110CE, ND110CX,
 
 /* Use lvl0 as default to start with, and then just always(!!!) set all levels when setting STS MSB flags */
 /* so by default we use reg[0][_STS] as MSB STS */
-#define CurrLEVEL	((gReg->reg[0][_STS] & 0x0f00) >>8)
-#define gPIL		((gReg->reg[0][_STS] & 0x0f00) >>8)
+#define CurrLEVEL	((gReg->myreg_MSB & 0x0f00) >>8)
+#define gPIL		((gReg->myreg_MSB & 0x0f00) >>8)
 
 /* Highest runlevel with PIE AND PID bits both set */
 #define gPK		gReg->myreg_PK
 
+/* Event bits for cpu_events, posted by PostEvent and handled by DoEvents in the cpu loop */
+#define EVT_PK		0x0001	/* PID/PIE/IID changed, find PK again */
+#define EVT_HEATMAP	0x0002	/* Write the heatmap file, see heatmap.c */
+#define EVT_WATCH	0x0004	/* A watched page was touched, see watch.c */
+
+/* Heatmap counters per physical page, see heatmap.c */
+#define HM_READ		0
+#define HM_WRITE	1
+#define HM_FETCH	2
+#define HM_KINDS	3
+
+/* Count n accesses to physical address paddr, nothing unless built with -DHEATMAP */
+#ifdef HEATMAP
+#define HEAT_N(kind,paddr,n) do { \
+	if (hm_count) \
+		hm_count[(((HEATMAP_LEVELS) ? CurrLEVEL * MEMPTSIZE : 0) + ((paddr) >> 10)) * HM_KINDS + (kind)] += (n); \
+	} while (0)
+#else
+#define HEAT_N(kind,paddr,n)
+#endif
+#define HEAT(kind,paddr)	HEAT_N(kind,paddr,1)
+
+#define EXT_MAX		16	/* Max number of extension files, see ext.c */
+#define HLE_MAX		16	/* Max number of hle routines, see hle.c */
+#define WATCH_MAX	16	/* Max number of watchpoints, see watch.c */
+
 /* The complete Status register both MSB and LSB for current runlevel. Read only MACRO */
-#define gSTSr		((gReg->reg[0][_STS] & 0xFF00) | (gReg->reg[(gReg->reg[][_STS] & 0x0f00) >>8][_STS] & 0x00FF))
+#define gSTSr		(gReg->myreg_MSB | (gReg->myreg_CUR[_STS] & 0x00FF))
 
 #define InstructionRegister	gReg->myreg_IR
 #define PrefetchBuffer		gReg->myreg_PFB
 
-#define STS_PTM  ((gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_STS] & 0x0001)>>0)	/* */
-#define STS_TG   ((gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_STS] & 0x0002)>>1)	/* */
-#define STS_K    ((gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_STS] & 0x0004)>>2)	/* */
-#define STS_Z    ((gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_STS] & 0x0008)>>3)	/* */
-#define STS_Q    ((gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_STS] & 0x0010)>>4)	/* */
-#define STS_O    ((gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_STS] & 0x0020)>>5)	/* */
-#define STS_C    ((gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_STS] & 0x0040)>>6)	/* */
-#define STS_M    ((gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_STS] & 0x0080)>>7)	/* */
-#define STS_PL   ((gReg->reg[0][_STS] & 0x0f00) >>8)					/* Program runlevel */
-#define STS_N100 ((gReg->reg[0][_STS] & 0x1000) >>12)					/* Nord 100 indicator */
-#define STS_SEXI ((gReg->reg[0][_STS] & 0x2000) >>13)					/* Extended MMS adressing on/off indicator (24 bit instead of 19 bit*/
-#define STS_PONI ((gReg->reg[0][_STS] & 0x4000) >>14)					/* Memory management on/off indicator */
-#define STS_IONI ((gReg->reg[0][_STS] & 0x8000) >>15)					/* Interrupt system on/off indicator */
+/*
+ * Handler for an instruction word, see Setup_Instructions. myreg_DISP is
+ * the table for the current ring, with privileged instructions trapping
+ * in rings 0 and 1.
+ */
+#ifdef COMPACT_DISPATCH
+extern ushort instr_index[65536];
+#define INSTR_FUNC(instr)	(gReg->myreg_DISP[instr_index[(ushort)(instr)]])
+#else
+#define INSTR_FUNC(instr)	(gReg->myreg_DISP[(ushort)(instr)])
+#endif
+
+#define STS_PTM  ((gReg->myreg_CUR[_STS] & 0x0001)>>0)	/* */
+#define STS_TG   ((gReg->myreg_CUR[_STS] & 0x0002)>>1)	/* */
+#define STS_K    ((gReg->myreg_CUR[_STS] & 0x0004)>>2)	/* */
+#define STS_Z    ((gReg->myreg_CUR[_STS] & 0x0008)>>3)	/* */
+#define STS_Q    ((gReg->myreg_CUR[_STS] & 0x0010)>>4)	/* */
+#define STS_O    ((gReg->myreg_CUR[_STS] & 0x0020)>>5)	/* */
+#define STS_C    ((gReg->myreg_CUR[_STS] & 0x0040)>>6)	/* */
+#define STS_M    ((gReg->myreg_CUR[_STS] & 0x0080)>>7)	/* */
+#define STS_PL   ((gReg->myreg_MSB & 0x0f00) >>8)					/* Program runlevel */
+#define STS_N100 ((gReg->myreg_MSB & 0x1000) >>12)					/* Nord 100 indicator */
+#define STS_SEXI ((gReg->myreg_MSB & 0x2000) >>13)					/* Extended MMS adressing on/off indicator (24 bit instead of 19 bit*/
+#define STS_PONI ((gReg->myreg_MSB & 0x4000) >>14)					/* Memory management on/off indicator */
+#define STS_IONI ((gReg->myreg_MSB & 0x8000) >>15)					/* Interrupt system on/off indicator */
 
 #define UNDEF_INSTR ((ushort)0142500)
 
@@ -41,6 +41,13 @@
 int main(int argc, char *argv[]) {
 	int res;
 
+	if ((argc > 1) && !strcmp(argv[1],"-dispatchbench")) { /* Compare dispatch table layouts and exit */
+		setup_memory();
+		Setup_Instructions();
+		DispatchBench();
+		return(0);
+	}
+
 	srand ( time(NULL) ); /* Generate PRNG Seed */
 
 	used=calloc(1,sizeof(struct rusage)); /* Perf counter stuff */
@@ -78,6 +85,7 @@ int main(int argc, char *argv[]) {
 
 	setup_cpu();
 	program_load();
+	Setup_Watch();	/* after loading, it reads straight into memory */
 
 	if (PANEL_PROCESSOR)
 		setup_pap();
@@ -103,6 +111,8 @@ int main(int argc, char *argv[]) {
 	printf("Current cpu cycle time is:%f microsecs\n",(totaltime/((float)instr_counter/1000000)));
 
 	disasm_dump();
+	HeatmapDump();
+	close_shm();
 
 	return(0);
 }
@@ -58,6 +58,7 @@ extern void setsignals(void);
 extern void daemonize(void);
 extern void start_threads(void);
 extern void stop_threads(void);
+extern void setup_memory(void);
 extern void setup_cpu(void);
 extern void program_load(void);
 extern void blocksignals();
@@ -65,7 +66,12 @@ extern int trace_open();
 extern void disasm_addword(ushort addr, ushort myword);
 extern void disasm_init();
 extern void disasm_dump();
+extern void HeatmapDump(void);
+extern void Setup_Watch(void);
+extern void close_shm(void);
 extern void setup_pap();
+extern void Setup_Instructions();
+extern void DispatchBench(void);
 
 
 int main(int argc, char *argv[]);
@@ -0,0 +1,102 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * Interface for native extension instructions.
+ *
+ * A shared object listed under "extensions" in nd100em.conf is loaded
+ * at startup and its nd100ext_init() is called with the table below.
+ * It can then claim any of the user microcode slots USER1..USER10
+ * (USER1 = 0140200-0140277, USER2 = 0140500-0140577 and so on, see
+ * ext_slot_base in ext.c) with register_slot(). Every instruction
+ * in the slot's 64 word range then calls the handler with the
+ * instruction word. The handler returns what should happen next.
+ *
+ * This header is all an extension needs, it does not depend on the
+ * emulator's own headers. Build extensions with something like:
+ *	gcc -shared -fPIC -o crc.so crc.c
+ */
+
+#ifndef ND100EXT_H
+#define ND100EXT_H
+
+#define ND100EXT_VERSION	1
+
+/* Register numbers in the array returned by regs() */
+#define ND100EXT_STS	0
+#define ND100EXT_D	1
+#define ND100EXT_P	2
+#define ND100EXT_B	3
+#define ND100EXT_L	4
+#define ND100EXT_A	5
+#define ND100EXT_T	6
+#define ND100EXT_X	7
+
+/* STS bits, in the low byte of regs()[ND100EXT_STS] */
+#define ND100EXT_STS_Z	(1<<3)	/* error indicator */
+#define ND100EXT_STS_Q	(1<<4)	/* dynamic overflow */
+#define ND100EXT_STS_O	(1<<5)	/* static overflow */
+#define ND100EXT_STS_C	(1<<6)	/* carry */
+#define ND100EXT_STS_M	(1<<7)	/* multishift link */
+
+/* byte_select for write() */
+#define ND100EXT_MSB	0
+#define ND100EXT_LSB	1
+#define ND100EXT_WORD	2
+
+/* Handler return values */
+#define ND100EXT_NEXT		0	/* done, continue at P+1 */
+#define ND100EXT_JUMP		1	/* done, handler has set P itself */
+#define ND100EXT_ILLEGAL	-1	/* handle as an illegal instruction */
+
+struct nd100ext_api {
+	int	version;	/* ND100EXT_VERSION */
+
+	/*
+	 * Registers of the current level. STS is up to date when a
+	 * handler is called, and the handler may change its low byte.
+	 */
+	unsigned short	*(*regs)(void);
+
+	/*
+	 * Memory access through the page tables like the instructions
+	 * do, apt selects the alternative page table. A page fault or
+	 * protection violation aborts the instruction as for any other:
+	 * the handler does not return, and the instruction is run again
+	 * once level 14 has dealt with it. So leave the registers alone
+	 * until the last access is done.
+	 */
+	unsigned short	(*read)(unsigned short addr, int apt);
+	void	(*write)(unsigned short value, unsigned short addr, int apt, int byte_select);
+
+	/*
+	 * Claim user microcode slot 1..10 for handler.
+	 * Returns 0 if ok, -1 if the slot is taken or not free on this cpu.
+	 */
+	int	(*register_slot)(int slot, int (*handler)(unsigned short instr));
+};
+
+/* The one symbol an extension has to export. Return 0 if ok. */
+typedef int (*nd100ext_init_t)(const struct nd100ext_api *api);
+#define ND100EXT_INIT	"nd100ext_init"
+
+#endif /* ND100EXT_H */
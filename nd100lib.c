@@ -32,6 +32,7 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
 #include <limits.h>
 #include <string.h>
 #include <math.h>
@@ -90,7 +91,7 @@ int bpun_load() {
 	int count, b_num, c_num;
 	char loadtype[]="r";
 	ushort *addr;
-	addr = (ushort *)&VolatileMemory;
+	addr = VolatileMemory->n_Array;
 
 	if (debug) fprintf(debugfile,"BPUN file load:\n");
 	counter=0;
@@ -189,7 +190,7 @@ int bp_load() {
 
 	if (debug) fprintf(debugfile,"BP file load:\n");
 	bin_file=fopen(bpun,loadtype);
-	fread(&VolatileMemory,2,65536,bin_file);
+	fread(VolatileMemory->n_Array,2,65536,bin_file);
 	for(i=0;i<65536;i++){
 		if (DISASM){
 			eff_word = MemoryRead((ushort)i,0);
@@ -271,6 +272,7 @@ void RemThreadChain(struct ThreadChain * elem){
 int nd100emconf(){
 	char conf[]="nd100em.conf";
 	char *tmpstr;
+	int i;
 	config_setting_t *setting = NULL;
 
 	pCFG=malloc(sizeof(struct config_t));
@@ -363,6 +365,85 @@ int nd100emconf(){
 	} else {
 		DISASM = 0;
 	}
+	setting = config_lookup(pCFG, "blockcache");
+	if (setting) {
+		BLOCK_CACHE = config_setting_get_int(setting);
+	} else {
+		BLOCK_CACHE = 1;
+	}
+	setting = config_lookup(pCFG, "jit");
+	if (setting) {
+		JIT = config_setting_get_int(setting);
+	} else {
+		JIT = 0;
+	}
+	setting = config_lookup(pCFG, "fusion");
+	if (setting) {
+		FUSION = config_setting_get_int(setting);
+	} else {
+		FUSION = 1;
+	}
+	setting = config_lookup(pCFG, "memsize");
+	if (setting) {
+		i = config_setting_get_int(setting);	/* KWords */
+		for (ND_Memsize = 64*1024; (ND_Memsize < (ulong)i*1024) && (ND_Memsize < MEMPTSIZE*1024); ND_Memsize <<= 1)
+			;
+	} else {
+		ND_Memsize = MEMPTSIZE*1024;
+	}
+	setting = config_lookup(pCFG, "hugepages");
+	if (setting) {
+		tmpstr = (char *)config_setting_get_string(setting);
+		if (tmpstr) {
+			if(strcmp("transparent",tmpstr)==0){
+				HugePages = HUGE_TRANSPARENT;
+			} else if(strcmp("explicit",tmpstr)==0){
+				HugePages = HUGE_EXPLICIT;
+			} else {
+				HugePages = HUGE_OFF;
+			}
+		} else {
+			HugePages = HUGE_OFF;
+		}
+	} else {
+		HugePages = HUGE_OFF;
+	}
+	setting = config_lookup(pCFG, "shm");
+	if (setting) {
+		tmpstr = (char *)config_setting_get_string(setting);
+		if (tmpstr)
+			SHM_NAME = strdup(tmpstr);
+	}
+	setting = config_lookup(pCFG, "shm_mode");
+	if (setting) {
+		tmpstr = (char *)config_setting_get_string(setting);
+		if (tmpstr)
+			SHM_MODE = strtol(tmpstr,NULL,8) & 0660;	/* user and group only */
+	} else {
+		SHM_MODE = 0600;
+	}
+	setting = config_lookup(pCFG, "heatmap");
+	if (setting) {
+		tmpstr = (char *)config_setting_get_string(setting);
+		if (tmpstr)
+			HEATMAP_FILE = strdup(tmpstr);
+	}
+	setting = config_lookup(pCFG, "heatmap_format");
+	if (setting) {
+		tmpstr = (char *)config_setting_get_string(setting);
+		if (tmpstr && (strcmp("binary",tmpstr)==0))
+			HEATMAP_BINARY = 1;
+		else
+			HEATMAP_BINARY = 0;
+	} else {
+		HEATMAP_BINARY = 0;
+	}
+	setting = config_lookup(pCFG, "heatmap_levels");
+	if (setting) {
+		HEATMAP_LEVELS = config_setting_get_int(setting);
+	} else {
+		HEATMAP_LEVELS = 0;
+	}
 	setting = config_lookup(pCFG, "panel");
 	if (setting) {
 		PANEL_PROCESSOR = config_setting_get_int(setting);
@@ -401,6 +482,39 @@ int nd100emconf(){
 		FDD_IMAGE_RO = 1;
 	}
 
+	setting = config_lookup(pCFG, "extensions");
+	if (setting) {
+		for (i=0;i<config_setting_length(setting) && EXT_COUNT<EXT_MAX;i++) {
+			tmpstr = (char *)config_setting_get_string_elem(setting,i);
+			if (tmpstr)
+				EXT_FILES[EXT_COUNT++] = strdup(tmpstr);
+		}
+	}
+
+	setting = config_lookup(pCFG, "hle");
+	if (setting) {
+		for (i=0;i<config_setting_length(setting) && HLE_COUNT<HLE_MAX;i++) {
+			tmpstr = (char *)config_setting_get_string_elem(setting,i);
+			if (tmpstr)
+				HLE_NAMES[HLE_COUNT++] = strdup(tmpstr);
+		}
+	}
+
+	setting = config_lookup(pCFG, "watch");
+	if (setting) {
+		for (i=0;i<config_setting_length(setting) && WATCH_COUNT<WATCH_MAX;i++) {
+			tmpstr = (char *)config_setting_get_string_elem(setting,i);
+			if (tmpstr)
+				WATCH_SPECS[WATCH_COUNT++] = strdup(tmpstr);
+		}
+	}
+	setting = config_lookup(pCFG, "watch_stop");
+	if (setting) {
+		WATCH_STOP = config_setting_get_int(setting);
+	} else {
+		WATCH_STOP = 1;
+	}
+
 	config_destroy(pCFG);
 	free(pCFG);
 	CONFIG_OK = 1;      /* :TODO: No detailed checks of all dependant parameters yet */
@@ -430,6 +544,11 @@ void shutdown(int signum){
 	if (debug) fflush(debugfile);
 }
 
+/* SIGUSR1, have the cpu thread write the heatmap */
+void heatmap_handler (int signum){
+	PostEvent(EVT_HEATMAP);
+}
+
 void rtc_handler (int signum){
 	if (sem_post(&sem_rtc_tick) == -1) { /* release rtc tick  lock */
 		if (debug) fprintf(debugfile,"ERROR!!! sem_post failure rtc_handler\n");
@@ -453,6 +572,7 @@ void blocksignals() {
 	sigaddset (&new_set, SIGINT); /* kill signal we will catch in handles */
 	sigaddset (&new_set, SIGHUP); /* see above */
 	sigaddset (&new_set, SIGTERM); /* see above */
+	sigaddset (&new_set, SIGUSR1); /* heatmap dump, handled in the signal thread */
 	pthread_sigmask (SIG_BLOCK, &new_set, &old_set);
 }
 
@@ -461,6 +581,7 @@ void setsignalhandlers() {
 	static sigset_t   old_set;
 	static struct sigaction act;
 	static struct sigaction act_alrm;
+	static struct sigaction act_usr1;
 
 	/* set up handler for SIGINT, SIGHUP, SIGTERM */
 	act.sa_handler = &shutdown;
@@ -483,6 +604,15 @@ void setsignalhandlers() {
 	sigemptyset (&old_set);
 	sigaddset (&new_set, SIGALRM);
 	pthread_sigmask (SIG_UNBLOCK, &new_set, &old_set);
+
+	/* set up handler for SIGUSR1 */
+	act_usr1.sa_handler = &heatmap_handler;
+	sigemptyset (&act_usr1.sa_mask);
+	sigaction (SIGUSR1, &act_usr1, NULL);
+	sigemptyset (&new_set);
+	sigemptyset (&old_set);
+	sigaddset (&new_set, SIGUSR1);
+	pthread_sigmask (SIG_UNBLOCK, &new_set, &old_set);
 	return;
 }
 
@@ -608,18 +738,159 @@ void stop_threads(){
 	}
 }
 
+/*
+ * setup_memory - Map the guest memory.
+ * All of _NDRAM_ is mapped, but as anonymous memory nothing is committed
+ * until it is touched, so a small machine only costs what it uses. The
+ * ND_Memsize words of guest memory at the start can be put on huge pages,
+ * the rest is never touched, a page table entry past it gives memory out
+ * of range.
+ */
+void setup_memory(){
+	size_t hsize = HUGEPAGE_SIZE;
+	size_t used = (ND_Memsize * sizeof(ushort) + hsize - 1) & ~(hsize - 1);
+	char *p;
+
+	/* Extra room to start on a huge page boundary */
+	p = mmap(NULL,sizeof(_NDRAM_) + hsize,PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+	if (p == MAP_FAILED) {
+		printf("ERROR mapping %lu KWords of guest memory!!!\n",(unsigned long)MEMPTSIZE);
+		exit(1);
+	}
+	p = (char *)(((unsigned long)p + hsize - 1) & ~(hsize - 1));
+	switch (HugePages) {
+	case HUGE_EXPLICIT:
+#ifdef MAP_HUGETLB
+		if (mmap(p,used,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED|MAP_HUGETLB,-1,0) != MAP_FAILED)
+			break;
+		/* Not enough huge pages reserved, make sure the normal mapping is still there */
+		if (mmap(p,used,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED|MAP_NORESERVE,-1,0) == MAP_FAILED) {
+			printf("ERROR mapping guest memory!!!\n");
+			exit(1);
+		}
+#endif
+		fprintf(stderr,"No huge pages for guest memory, using normal pages\n");
+		break;
+	case HUGE_TRANSPARENT:
+#ifdef MADV_HUGEPAGE
+		if (madvise(p,used,MADV_HUGEPAGE) == 0)
+			break;
+#endif
+		fprintf(stderr,"No transparent huge pages for guest memory, using normal pages\n");
+		break;
+	default:
+		break;
+	}
+	VolatileMemory = (_NDRAM_ *)p;
+}
+
+/*
+ * setup_shm - Put guest memory, registers, page tables and page bits in the
+ * POSIX shared memory object SHM_NAME, after a struct ShmHeader saying where
+ * they are, so other programs can map it read only and look at the
+ * running machine. The object is created new, so a name in use by
+ * another emulator is not taken over, and removed again by close_shm.
+ * Returns false if it can not be set up.
+ */
+bool setup_shm(){
+	size_t hsize = HUGEPAGE_SIZE;
+	size_t psize = sysconf(_SC_PAGESIZE);
+	size_t regs_off, pt_off, bits_off, mem_off, total;
+	size_t used = (ND_Memsize * sizeof(ushort) + hsize - 1) & ~(hsize - 1);
+	char *p;
+	int fd;
+
+	regs_off = psize;
+	pt_off = (regs_off + sizeof(struct CpuRegs) + psize - 1) & ~(psize - 1);
+	bits_off = (pt_off + sizeof(union NewPT) + psize - 1) & ~(psize - 1);
+	mem_off = (bits_off + sizeof(struct PageBits) + hsize - 1) & ~(hsize - 1);	/* huge page aligned */
+	total = mem_off + sizeof(_NDRAM_);
+
+	fd = shm_open(SHM_NAME,O_RDWR|O_CREAT|O_EXCL,SHM_MODE);
+	if (fd == -1) {
+		fprintf(stderr,"Can not create shared memory %s: %s\n",SHM_NAME,strerror(errno));
+		if (errno == EEXIST)
+			fprintf(stderr,"Left from an emulator no longer running? Then remove /dev/shm%s\n",SHM_NAME);
+		return(false);
+	}
+	/* Like setup_memory, nothing is committed until it is touched */
+	if (ftruncate(fd,total) ||
+	    ((p = mmap(NULL,total,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_NORESERVE,fd,0)) == MAP_FAILED)) {
+		fprintf(stderr,"Can not map shared memory %s: %s\n",SHM_NAME,strerror(errno));
+		close(fd);
+		shm_unlink(SHM_NAME);
+		return(false);
+	}
+	close(fd);
+
+	switch (HugePages) {
+	case HUGE_EXPLICIT:
+		fprintf(stderr,"No explicit huge pages for shared guest memory, using normal pages\n");
+		break;
+	case HUGE_TRANSPARENT:
+#ifdef MADV_HUGEPAGE
+		if (madvise(p + mem_off,used,MADV_HUGEPAGE) == 0)
+			break;
+#endif
+		fprintf(stderr,"No transparent huge pages for guest memory, using normal pages\n");
+		break;
+	default:
+		break;
+	}
+
+	gShm = (struct ShmHeader *)p;
+	gShm->version = SHM_VERSION;
+	gShm->hdr_size = sizeof(struct ShmHeader);
+	gShm->pid = getpid();
+	gShm->memsize = ND_Memsize;
+	gShm->regs_off = regs_off;
+	gShm->regs_size = sizeof(struct CpuRegs);
+	gShm->pt_off = pt_off;
+	gShm->pt_size = sizeof(union NewPT);
+	gShm->bits_off = bits_off;
+	gShm->bits_size = sizeof(struct PageBits);
+	gShm->mem_off = mem_off;
+	gShm->mem_size = sizeof(_NDRAM_);
+	gReg = (struct CpuRegs *)(p + regs_off);
+	gPT = (union NewPT *)(p + pt_off);
+	gPageBits = (struct PageBits *)(p + bits_off);
+	VolatileMemory = (_NDRAM_ *)(p + mem_off);
+	__atomic_store_n(&gShm->generation,1,__ATOMIC_SEQ_CST);
+	memcpy(gShm->magic,SHM_MAGIC,sizeof(gShm->magic));	/* header complete */
+	if (debug) fprintf(debugfile,"Machine exported in shared memory %s\n",SHM_NAME);
+	return(true);
+}
+
+/*
+ * close_shm - Remove the shared memory object at exit. Programs still
+ * having it mapped keep their copy.
+ */
+void close_shm(){
+	if (gShm)
+		shm_unlink(SHM_NAME);
+}
+
 void setup_cpu(){
-	/* initialize an empty register set */
-	gReg=calloc(1,sizeof(struct CpuRegs));
-	/* initialize an empty pagetable */
-	gPT=calloc(1,sizeof(union NewPT));
+	/* Map guest memory, registers, page tables and page bits, in shared memory if asked for */
+	if (!SHM_NAME || !setup_shm()) {
+		setup_memory();
+		/* initialize an empty register set */
+		gReg=calloc(1,sizeof(struct CpuRegs));
+		/* initialize an empty pagetable */
+		gPT=calloc(1,sizeof(union NewPT));
+		/* and no PGU or WIP waiting for it */
+		gPageBits=calloc(1,sizeof(struct PageBits));
+	}
+	/* Heatmap counters, if asked for */
+	Setup_Heatmap();
 	/* Initialize IO handler functions */
 	Setup_IO_Handlers();
 	/* initialize floppy drive data structures */
 	floppy_init();
 
-	setbit(_STS,_O,1);
 	setbit_STS_MSB(_N100,1);
+	setbit(_STS,_O,1);
 	gCSR = 1<<2;	/* this bit sets the cache as not available */
 
 	/* Initialise Ident List  pointer to null */
@@ -642,7 +913,7 @@ void program_load(){
 		gPC = (CONFIG_OK) ? STARTADDR : 0;
 		break;
 	case FLOPPY:
-		sectorread(0,0,1,(ushort *)&VolatileMemory);
+		sectorread(0,0,1,VolatileMemory->n_Array);
 		gPC = 0;
 		break;
 	}
@@ -22,6 +22,9 @@
 
 extern int trace;
 extern int DISASM;
+extern int BLOCK_CACHE;
+extern int JIT;
+extern int FUSION;
 extern ushort PANEL_PROCESSOR;
 
 char debugname[]="debug.log";
@@ -31,12 +34,14 @@ int debug = 0;
 
 #define RUNNING_DIR     "/tmp"
 
-extern _NDRAM_		VolatileMemory;
+extern _NDRAM_		*VolatileMemory;
+extern ulong		ND_Memsize;
 extern _RUNMODE_	CurrentCPURunMode;
 extern _CPUTYPE_	CurrentCPUType;
 
 extern struct CpuRegs *gReg;
 extern union NewPT *gPT;
+extern struct PageBits *gPageBits;
 extern struct MemTraceList *gMemTrace;
 extern struct IdentChain *gIdentChain;
 
@@ -61,10 +66,28 @@ int DISASM = 0;
 int DAEMON = 0;
 /* is console on a socket, or just the local one? */
 int CONSOLE_IS_SOCKET=0;
+/* Huge pages for guest memory? */
+typedef enum {HUGE_OFF, HUGE_TRANSPARENT, HUGE_EXPLICIT} _HUGEPAGES_;
+_HUGEPAGES_	HugePages = HUGE_OFF;
+/* Name of the shared memory object to export the machine in, if any */
+char *SHM_NAME = NULL;
+mode_t SHM_MODE = 0600;
+struct ShmHeader *gShm = NULL;
 
 struct config_t *pCFG;
 
 extern char *FDD_IMAGE_NAME;
+
+extern char *EXT_FILES[EXT_MAX];
+extern int EXT_COUNT;
+extern char *HLE_NAMES[HLE_MAX];
+extern int HLE_COUNT;
+extern char *HEATMAP_FILE;
+extern int HEATMAP_BINARY;
+extern int HEATMAP_LEVELS;
+extern char *WATCH_SPECS[WATCH_MAX];
+extern int WATCH_COUNT;
+extern int WATCH_STOP;
 extern bool FDD_IMAGE_RO;
 
 
@@ -93,6 +116,8 @@ extern void setbit_STS_MSB(ushort stsbit, char val);
 extern int sectorread (char cyl, char side, char sector, unsigned short *addr);
 extern void disasm_addword(ushort addr, ushort myword);
 extern void panel_processor_thread();
+extern void PostEvent(int evt);
+extern void Setup_Heatmap(void);
 
 
 int octalstr_to_integer(char *str);
@@ -106,11 +131,15 @@ struct ThreadChain *AddThreadChain(void);
 void RemThreadChain(struct ThreadChain * elem);
 int nd100emconf(void);
 void shutdown(int signum);
+void heatmap_handler(int signum);
 void setsignals(void);
 void daemonize(void);
 pthread_t add_thread(void *funcpointer, bool is_jointype);
 void start_threads(void);
 void stop_threads(void);
+void setup_memory(void);
+bool setup_shm(void);
+void close_shm(void);
 void setup_cpu(void);
 void program_load(void);
 
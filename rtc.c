@@ -83,6 +83,12 @@ void rtc_20(){
 			CurrentCPURunMode = SHUTDOWN;
 		}
 
+		if (gShm) {	/* Show programs looking at the shared memory that we are running */
+			gShm->instructions = (unsigned long long)instr_counter;
+			gShm->runmode = CurrentCPURunMode;
+			__atomic_add_fetch(&gShm->generation,1,__ATOMIC_SEQ_CST);
+		}
+
 		if(PANEL_PROCESSOR) {	/* OK here we should "tick" the panel processor?? */
 // TODO: This should most likely be changed to use a separate posix timer and signal thread etc. SIGUSR1 maybe
 /*TODO: tick panel second counter, also check if this is the right way, since we can "reset" the rtc 20ms timer */
@@ -99,13 +105,12 @@ void rtc_20(){
 			if(CurrentCPURunMode != STOP) {
 				while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
 					continue;       /* Restart if interrupted by handler */
-				gPID |= 0x2000; /* Bit 13 */
 				AddIdentChain(13,1,our_rnd_id); /* Add interrupt to ident chain, lvl13, ident code 1, and identify us */
 				if (sem_post(&sem_int) == -1) { /* release interrupt lock */
 					if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
 					CurrentCPURunMode = SHUTDOWN;
 				}
-				checkPK();
+				interrupt(13,0); /* Bit 13, lock free */
 			}
 //			if(!PANEL_PROCESSOR) /* No panel processor available, trigger mopc here */
 				if (MODE_OPCOM) {
@@ -42,9 +42,11 @@ extern ushort PANEL_PROCESSOR;
 extern _RUNMODE_      CurrentCPURunMode;
 extern int debug;
 extern FILE *debugfile;
+extern double instr_counter;
+extern struct ShmHeader *gShm;
 
 void rtc_20(void);
 void RTC_IO(ushort ioadd);
 
 extern void AddIdentChain(char lvl, ushort identnum, int callerid);
-extern void checkPK();
+extern void interrupt(ushort lvl, ushort sub);
@@ -141,6 +141,7 @@ void trace_instr(ushort instr){
 
 void trace_regs() {
 	int i,j;
+	SyncSTS();
 	j=CurrLEVEL;
 	if (trace & 0x02){
 		for(i=0; i<=7; i++) {
@@ -64,6 +64,7 @@ extern struct CpuRegs *gReg;
 
 extern void OpToStr(char *opstr, ushort operand);
 extern ushort extract_opcode(ushort instr);
+extern void SyncSTS(void);
 
 void trace_instr(ushort instr);
 void disasm_addword(ushort addr, ushort myword);
@@ -0,0 +1,302 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Guest data watchpoints.
+ *
+ * The words to watch are set with "watch" in nd100em.conf, each as a
+ * string with "r", "w" or "rw" and an octal address, e.g. "w 12345" for
+ * writes to virtual address 12345, or "rw p1234567" for any access to
+ * physical address 1234567.
+ *
+ * Nothing in the emulator checks for them. Instead the host pages of
+ * guest memory holding watched words are protected, so the access faults
+ * wherever it is done: the interpreter, the TLB fast paths, bulk moves,
+ * jit and hle native code. The fault handler notes the address, opens
+ * the page and lets the access go on. The cpu thread closes the page
+ * again after the instruction or block, and if the word was a watched
+ * one reports it, and stops the cpu unless "watch_stop" is 0. Other
+ * memory runs just as fast as without watchpoints, only accesses near
+ * a watched word (same host page) take the fault.
+ *
+ * A virtual address is watched in every physical page some page table
+ * maps its page to, and in POF mode, and is only reported when the
+ * current level really reaches it through that address. Page table
+ * writes for a watched page move the watch along.
+ *
+ * Limits: a second access to the same page within a block may not be
+ * seen, file reads straight into guest memory (boot loading) fail on a
+ * watched page, and explicit huge pages can not be protected a host
+ * page at a time, so watchpoints need hugepages off or transparent.
+ */
+
+#define _GNU_SOURCE	/* REG_ERR */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "nd100.h"
+#include "watch.h"
+
+#define WATCH_PADDR	9	/* POF, and 4 page tables with and without SEXI */
+#define WATCH_HITS	16	/* Faults noted between two WatchEvents */
+
+struct WatchPoint {
+	ulong addr;			/* virtual or physical word address */
+	bool virt;
+	bool read;
+	bool write;
+	int npaddr;
+	ulong paddr[WATCH_PADDR];	/* physical words it may be */
+};
+
+struct WatchHit {
+	ulong paddr;
+	ushort p;		/* P when it happened */
+	int write;		/* 1 write, 0 read, -1 not known */
+};
+
+static struct WatchPoint wp[WATCH_MAX];
+static int wp_count = 0;
+
+static size_t wp_hostpage;		/* host page size in bytes */
+static unsigned char *wp_prot;		/* 0x80 | PROT_xxx for each watched host page of guest memory, else 0 */
+static int wp_pages[WATCH_MAX*WATCH_PADDR];	/* host pages with a watched word */
+static int wp_npages = 0;
+
+static struct WatchHit wp_hit[WATCH_HITS];
+static int wp_nhit = 0;
+
+/*
+ * WatchAdd - Add one watchpoint from its config string.
+ */
+static bool WatchAdd(char *spec) {
+	struct WatchPoint *w = &wp[wp_count];
+	char kind[4], where[32], *end;
+
+	if (sscanf(spec,"%3s %31s",kind,where) != 2)
+		return(false);
+	w->read = (strchr(kind,'r') != NULL);
+	w->write = (strchr(kind,'w') != NULL);
+	w->virt = (where[0] != 'p');
+	w->addr = strtoul((w->virt) ? where : &where[1],&end,8);
+	if (*end || (!w->read && !w->write))
+		return(false);
+	if ((w->virt) ? (w->addr > 0177777) : (w->addr >= ND_Memsize))
+		return(false);
+	if (w->virt)
+		wp_vpn |= 1ULL << (w->addr >> 10);
+	wp_count++;
+	return(true);
+}
+
+/*
+ * WatchPaddr - Add a physical word to the ones a watchpoint may be.
+ */
+static void WatchPaddr(struct WatchPoint *w, ulong paddr) {
+	int i;
+
+	if (paddr >= ND_Memsize)
+		return;
+	for (i=0;i<w->npaddr;i++)
+		if (w->paddr[i] == paddr)
+			return;
+	w->paddr[w->npaddr++] = paddr;
+}
+
+/*
+ * WatchMap - Find the physical words watched, and protect their host pages.
+ * Called at setup and when a page table entry for a watched virtual page
+ * is written.
+ */
+void WatchMap(void) {
+	struct WatchPoint *w;
+	char *base = (char *)VolatileMemory->n_Array;
+	ulong PTe;
+	int i, j, pt, hp, prot;
+
+	/* Open what is protected now */
+	for (i=0;i<wp_npages;i++) {
+		mprotect(base + (size_t)wp_pages[i] * wp_hostpage,wp_hostpage,PROT_READ|PROT_WRITE);
+		wp_prot[wp_pages[i]] = 0;
+	}
+	wp_npages = 0;
+
+	for (i=0;i<wp_count;i++) {
+		w = &wp[i];
+		w->npaddr = 0;
+		if (!w->virt) {
+			WatchPaddr(w,w->addr);
+		} else {
+			WatchPaddr(w,w->addr);	/* POF */
+			for (pt=0;pt<4;pt++) {
+				PTe = gPT->pt[pt][w->addr >> 10];
+				if (!(PTe & ((ulong)0x07<<29)))	/* not mapped */
+					continue;
+				WatchPaddr(w,((PTe & 0x3fff) << 10) | (w->addr & 01777));
+				WatchPaddr(w,((PTe & 0x01ff) << 10) | (w->addr & 01777));
+			}
+		}
+		prot = (w->read) ? PROT_NONE : PROT_READ;
+		for (j=0;j<w->npaddr;j++) {
+			hp = (w->paddr[j] * sizeof(ushort)) / wp_hostpage;
+			if (!wp_prot[hp])
+				wp_pages[wp_npages++] = hp;
+			if (!wp_prot[hp] || (prot == PROT_NONE))
+				wp_prot[hp] = (prot == PROT_NONE) ? 0x80 : (0x80 | PROT_READ);
+		}
+	}
+
+	for (i=0;i<wp_npages;i++) {
+		hp = wp_pages[i];
+		if (mprotect(base + (size_t)hp * wp_hostpage,wp_hostpage,wp_prot[hp] & ~0x80))
+			fprintf(stderr,"Can not protect guest memory for watchpoints\n");
+	}
+}
+
+/*
+ * WatchFault - SIGSEGV handler, any thread.
+ * Notes an access to a protected page and opens it so the access can go
+ * on. Anything else is not ours, and the default action is taken when
+ * the access is tried again.
+ */
+static void WatchFault(int signum, siginfo_t *si, void *ctx) {
+	char *a = (char *)si->si_addr;
+	char *base = (char *)VolatileMemory->n_Array;
+	ulong hp;
+	int i;
+
+	if ((a < base) || (a >= base + ND_Memsize * sizeof(ushort)) ||
+	    !wp_prot[hp = (a - base) / wp_hostpage]) {
+		signal(SIGSEGV,SIG_DFL);
+		return;
+	}
+	i = __atomic_fetch_add(&wp_nhit,1,__ATOMIC_SEQ_CST);
+	if (i < WATCH_HITS) {
+		wp_hit[i].paddr = (a - base) / sizeof(ushort);
+		wp_hit[i].p = gPC;
+#if defined(__x86_64__) && defined(REG_ERR)
+		wp_hit[i].write = (((ucontext_t *)ctx)->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+#else
+		wp_hit[i].write = ((wp_prot[hp] & ~0x80) == PROT_READ) ? 1 : -1;
+#endif
+	}
+	mprotect(base + hp * wp_hostpage,wp_hostpage,PROT_READ|PROT_WRITE);
+	PostEvent(EVT_WATCH);
+}
+
+/*
+ * WatchReaches - Is paddr where virtual watchpoint w is for the current level?
+ */
+static bool WatchReaches(struct WatchPoint *w, ulong paddr) {
+	ushort pcr = gReg->reg_PCR[CurrLEVEL];
+	ulong PTe;
+	int i, pt_num;
+
+	if (!STS_PONI)
+		return(paddr == w->addr);
+	for (i=0;i<2;i++) {
+		if (i && !STS_PTM)
+			break;
+		pt_num = (i) ? (pcr>>7) & 0x03 : (pcr>>9) & 0x03;	/* APT : PT */
+		PTe = gPT->pt[pt_num][w->addr >> 10];
+		if (!(PTe & ((ulong)0x07<<29)))
+			continue;
+		if (((((STS_SEXI) ? PTe & 0x3fff : PTe & 0x01ff) << 10) | (w->addr & 01777)) == paddr)
+			return(true);
+	}
+	return(false);
+}
+
+/*
+ * WatchEvents - Report watched words hit since last time, and close the
+ * pages the faults opened. Cpu thread only, from DoEvents.
+ */
+void WatchEvents(void) {
+	struct WatchHit *h;
+	struct WatchPoint *w;
+	char *base = (char *)VolatileMemory->n_Array;
+	char msg[128];
+	int n, i, j, k;
+
+	n = __atomic_exchange_n(&wp_nhit,0,__ATOMIC_SEQ_CST);
+	for (i=0;(i<n) && (i<WATCH_HITS);i++) {
+		h = &wp_hit[i];
+		for (j=0;j<wp_count;j++) {
+			w = &wp[j];
+			if (!((h->write == -1) || ((h->write) ? w->write : w->read)))
+				continue;
+			for (k=0;k<w->npaddr;k++)
+				if (w->paddr[k] == h->paddr)
+					break;
+			if ((k == w->npaddr) || (w->virt && !WatchReaches(w,h->paddr)))
+				continue;
+			snprintf(msg,sizeof(msg),"Watchpoint: %s %s%06lo (physical %08lo) at P=%06o level %d\n",
+				(h->write == -1) ? "access to" : (h->write) ? "write to" : "read of",
+				(w->virt) ? "" : "p",w->addr,h->paddr,h->p,CurrLEVEL);
+			fputs(msg,stderr);
+			if (debug) fputs(msg,debugfile);
+			if (WATCH_STOP)
+				CurrentCPURunMode = STOP;
+		}
+	}
+	if (n > WATCH_HITS)
+		fprintf(stderr,"Watchpoint: %d more accesses not looked at\n",n - WATCH_HITS);
+
+	for (i=0;i<wp_npages;i++)
+		mprotect(base + (size_t)wp_pages[i] * wp_hostpage,wp_hostpage,wp_prot[wp_pages[i]] & ~0x80);
+}
+
+/*
+ * Setup_Watch - Set up the watchpoints from the config and protect them.
+ * After the program is loaded, since loading reads straight into memory.
+ */
+void Setup_Watch(void) {
+	struct sigaction act;
+	int i;
+
+	for (i=0;i<WATCH_COUNT;i++)
+		if (!WatchAdd(WATCH_SPECS[i]))
+			fprintf(stderr,"Bad watchpoint \"%s\", ignored\n",WATCH_SPECS[i]);
+	if (!wp_count)
+		return;
+
+	wp_hostpage = sysconf(_SC_PAGESIZE);
+	wp_prot = calloc(sizeof(_NDRAM_) / wp_hostpage + 1,1);
+	if (!wp_prot) {
+		fprintf(stderr,"No memory for watchpoints\n");
+		wp_count = 0;
+		return;
+	}
+
+	memset(&act,0,sizeof(act));
+	act.sa_sigaction = &WatchFault;
+	act.sa_flags = SA_SIGINFO;
+	sigemptyset(&act.sa_mask);
+	sigaction(SIGSEGV,&act,NULL);
+
+	WatchMap();
+	if (debug) fprintf(debugfile,"Watchpoints: %d set\n",wp_count);
+}
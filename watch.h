@@ -0,0 +1,48 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+
+/*
+ * Guest data watchpoints, see watch.c
+ */
+
+/* Config, set from "watch" and "watch_stop" in nd100em.conf */
+char *WATCH_SPECS[WATCH_MAX];
+int WATCH_COUNT = 0;
+int WATCH_STOP = 1;
+
+/* Virtual pages with a watchpoint, PT_Write calls WatchMap when one of their entries changes */
+unsigned long long wp_vpn = 0;
+
+extern struct CpuRegs *gReg;
+extern union NewPT *gPT;
+extern _NDRAM_ *VolatileMemory;
+extern ulong ND_Memsize;
+extern _RUNMODE_ CurrentCPURunMode;
+extern int debug;
+extern FILE *debugfile;
+
+void Setup_Watch(void);
+void WatchMap(void);
+void WatchEvents(void);
+
+extern void PostEvent(int evt);